@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Just enough of a CBOR (RFC 7049) encoder for flat telemetry records:
+// maps, text, integers and single precision floats, written into a caller
+// owned buffer. Writes past the end are dropped and flagged.
+
+class CborWriter {
+ public:
+  CborWriter(uint8_t* buffer, size_t size) : buffer(buffer), size(size) {}
+
+  void map(uint8_t pairs) { head(5, pairs); }
+
+  void text(const char* value) {
+    size_t length = strlen(value);
+    head(3, length);
+    for (size_t i = 0; i < length; i++) put(value[i]);
+  }
+
+  void integer(int32_t value) {
+    if (value < 0) {
+      head(1, -1 - value);
+    } else {
+      head(0, value);
+    }
+  }
+
+  void real(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put(0xFA);
+    putBigEndian(bits, 4);
+  }
+
+  const uint8_t* data() const { return buffer; }
+  size_t length() const { return used; }
+  bool overflowed() const { return overflow; }
+
+ private:
+  uint8_t* buffer;
+  size_t size;
+  size_t used = 0;
+  bool overflow = false;
+
+  // Major type and argument in the shortest form
+  void head(uint8_t major, uint32_t value) {
+    major <<= 5;
+    if (value < 24) {
+      put(major | value);
+    } else if (value <= 0xFF) {
+      put(major | 24);
+      putBigEndian(value, 1);
+    } else if (value <= 0xFFFF) {
+      put(major | 25);
+      putBigEndian(value, 2);
+    } else {
+      put(major | 26);
+      putBigEndian(value, 4);
+    }
+  }
+
+  void putBigEndian(uint32_t value, uint8_t bytes) {
+    while (bytes-- > 0) put(value >> (bytes * 8));
+  }
+
+  void put(uint8_t byte) {
+    if (used < size) {
+      buffer[used++] = byte;
+    } else {
+      overflow = true;
+    }
+  }
+};
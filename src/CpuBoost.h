@@ -0,0 +1,96 @@
+#pragma once
+
+#include <Arduino.h>
+extern "C" {
+#include <user_interface.h>
+}
+
+// Runs the CPU at 160MHz during heavy phases and at 80MHz otherwise, timing
+// every phase at whichever frequency it ran so the policy can be tuned.
+
+enum BoostPhase {
+  BOOST_FETCH,
+  BOOST_RENDER,
+  BOOST_WIZARD,
+  BOOST_OTA,
+  BOOST_PHASE_COUNT
+};
+
+const char* const BOOST_PHASE_NAMES[BOOST_PHASE_COUNT] = {"fetch", "render",
+                                                          "wizard", "ota"};
+
+struct PhaseTiming {
+  uint32_t count;
+  uint32_t totalUs;
+  uint32_t maxUs;
+};
+
+// [phase][0] ran at 80MHz, [phase][1] at 160MHz
+PhaseTiming phaseTimings[BOOST_PHASE_COUNT][2];
+// Bitmask of phases that are boosted
+uint8_t boostedPhases = 0xFF;
+uint8_t boostDepth = 0;
+uint32_t boostStartedAt = 0;
+uint64_t boostedMicros = 0;
+
+void acquireCpuBoost() {
+  if (boostDepth++ > 0) return;
+  system_update_cpu_freq(SYS_CPU_160MHZ);
+  boostStartedAt = micros();
+}
+
+void releaseCpuBoost() {
+  if (boostDepth == 0 || --boostDepth > 0) return;
+  system_update_cpu_freq(SYS_CPU_80MHZ);
+  boostedMicros += micros() - boostStartedAt;
+}
+
+// Share of uptime spent boosted
+uint8_t boostPercent() {
+  return millis() ? (uint32_t)(boostedMicros / 10 / millis()) : 0;
+}
+
+void recordPhaseTiming(BoostPhase phase, bool boosted, uint32_t us) {
+  PhaseTiming& timing = phaseTimings[phase][boosted ? 1 : 0];
+  timing.count++;
+  timing.totalUs += us;
+  if (us > timing.maxUs) timing.maxUs = us;
+}
+
+String formatPhaseTimings() {
+  String timings;
+  for (uint8_t i = 0; i < BOOST_PHASE_COUNT; i++) {
+    for (uint8_t j = 0; j < 2; j++) {
+      const PhaseTiming& timing = phaseTimings[i][j];
+      if (timing.count == 0) continue;
+      if (timings.length() > 0) timings += ' ';
+      timings += String(BOOST_PHASE_NAMES[i]) + "@" + (j ? "160" : "80") +
+                 "=" + String(timing.totalUs / timing.count) + "/" +
+                 String(timing.maxUs) + "us";
+    }
+  }
+  return timings;
+}
+
+class BoostedPhase {
+ public:
+  explicit BoostedPhase(BoostPhase phase)
+      : phase(phase),
+        boosted(boostedPhases & (1 << phase)),
+        start(micros()) {
+    if (boosted) acquireCpuBoost();
+    // Nested in a boosted phase this runs at 160MHz regardless
+    fast = ESP.getCpuFreqMHz() > 80;
+  }
+
+  ~BoostedPhase() {
+    recordPhaseTiming(phase, fast, micros() - start);
+    if (boosted) releaseCpuBoost();
+  }
+
+ private:
+  BoostPhase phase;
+  bool boosted;
+  bool fast;
+  uint32_t start;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Splits a weather fetch into time to the first JSON byte and streaming
+// parse, using the parser callbacks the clients already implement. The
+// clients resolve, connect, request and read internally, so DNS and connect
+// time are part of the first byte time.
+
+struct FetchTiming {
+  uint32_t firstByteUs;
+  uint32_t parseUs;
+  uint32_t totalUs;
+  // Bumped on every fetch so publishers can skip unchanged timings
+  uint32_t fetches;
+};
+
+template <class Client>
+class TimedClient : public Client {
+ public:
+  FetchTiming timing = {};
+
+  void beginFetch() {
+    startedAt = micros();
+    firstByteAt = 0;
+    parsedAt = 0;
+  }
+
+  void endFetch() {
+    uint32_t now = micros();
+    timing.firstByteUs = firstByteAt ? firstByteAt - startedAt : 0;
+    timing.parseUs = firstByteAt && parsedAt ? parsedAt - firstByteAt : 0;
+    timing.totalUs = now - startedAt;
+    timing.fetches++;
+  }
+
+  void startDocument() override {
+    if (firstByteAt == 0) firstByteAt = micros();
+    Client::startDocument();
+  }
+
+  void endDocument() override {
+    parsedAt = micros();
+    Client::endDocument();
+  }
+
+ private:
+  uint32_t startedAt = 0;
+  uint32_t firstByteAt = 0;
+  uint32_t parsedAt = 0;
+};
+
+String formatFetchTiming(const FetchTiming& timing) {
+  return "first=" + String(timing.firstByteUs / 1000) + " parse=" +
+         String(timing.parseUs / 1000) + " total=" +
+         String(timing.totalUs / 1000) + "ms";
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Bounded queue of display messages in preallocated slots, so a flood of
+// messages never touches the heap. The highest priority message is shown
+// first, oldest first within a priority.
+
+#ifndef MESSAGE_QUEUE_SIZE
+#define MESSAGE_QUEUE_SIZE 4
+#endif
+// Longer messages are truncated
+#define MAX_MESSAGE_LENGTH 160
+#define MAX_MESSAGE_TITLE_LENGTH 15
+
+struct Message {
+  bool used;
+  uint16_t id;
+  uint8_t priority;
+  bool needsAcknowledge;
+  uint32_t queuedAt;
+  // Milliseconds after being queued before it is dropped, 0 for never
+  uint32_t ttlMs;
+  // 0 until first drawn
+  uint32_t shownAt;
+  char title[MAX_MESSAGE_TITLE_LENGTH + 1];
+  char text[MAX_MESSAGE_LENGTH + 1];
+};
+
+class MessageQueue {
+ public:
+  // Returns the id of the queued message, 0 if it was dropped. When full the
+  // oldest message of the lowest priority makes room, unless that is higher
+  // than the new one.
+  uint16_t push(const char* title, const char* text, uint8_t priority,
+                bool needsAcknowledge, uint32_t ttlMs) {
+    Message* slot = nullptr;
+    Message* victim = nullptr;
+    for (uint8_t i = 0; i < MESSAGE_QUEUE_SIZE; i++) {
+      Message& message = slots[i];
+      if (!message.used) {
+        slot = &message;
+        break;
+      }
+      if (victim == nullptr || message.priority < victim->priority ||
+          (message.priority == victim->priority &&
+           (int32_t)(message.queuedAt - victim->queuedAt) < 0)) {
+        victim = &message;
+      }
+    }
+    if (slot == nullptr) {
+      droppedCount++;
+      if (victim->priority > priority) return 0;
+      slot = victim;
+    }
+
+    if (++lastId == 0) lastId = 1;
+    slot->used = true;
+    slot->id = lastId;
+    slot->priority = priority;
+    slot->needsAcknowledge = needsAcknowledge;
+    slot->queuedAt = millis();
+    slot->ttlMs = ttlMs;
+    slot->shownAt = 0;
+    strlcpy(slot->title, title, sizeof(slot->title));
+    strlcpy(slot->text, text, sizeof(slot->text));
+    return lastId;
+  }
+
+  // Message to show, nullptr if the queue is empty
+  Message* current() {
+    Message* next = nullptr;
+    for (uint8_t i = 0; i < MESSAGE_QUEUE_SIZE; i++) {
+      Message& message = slots[i];
+      if (!message.used) continue;
+      if (next == nullptr || message.priority > next->priority ||
+          (message.priority == next->priority &&
+           (int32_t)(message.queuedAt - next->queuedAt) < 0)) {
+        next = &message;
+      }
+    }
+    return next;
+  }
+
+  Message* find(uint16_t id) {
+    for (uint8_t i = 0; i < MESSAGE_QUEUE_SIZE; i++) {
+      if (slots[i].used && slots[i].id == id) return &slots[i];
+    }
+    return nullptr;
+  }
+
+  bool remove(uint16_t id) {
+    Message* message = find(id);
+    if (message == nullptr) return false;
+    message->used = false;
+    return true;
+  }
+
+  // Drops expired messages, returns the id of one dropped or 0 if none were
+  uint16_t expire() {
+    uint32_t now = millis();
+    uint16_t expiredId = 0;
+    for (uint8_t i = 0; i < MESSAGE_QUEUE_SIZE; i++) {
+      Message& message = slots[i];
+      if (!message.used || message.ttlMs == 0) continue;
+      if (now - message.queuedAt < message.ttlMs) continue;
+      message.used = false;
+      expiredCount++;
+      expiredId = message.id;
+    }
+    return expiredId;
+  }
+
+  uint8_t depth() const {
+    uint8_t used = 0;
+    for (uint8_t i = 0; i < MESSAGE_QUEUE_SIZE; i++) {
+      if (slots[i].used) used++;
+    }
+    return used;
+  }
+
+  uint32_t dropped() const { return droppedCount; }
+  uint32_t expired() const { return expiredCount; }
+
+ private:
+  Message slots[MESSAGE_QUEUE_SIZE] = {};
+  uint16_t lastId = 0;
+  uint32_t droppedCount = 0;
+  uint32_t expiredCount = 0;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Scoped timers feeding fixed bucket latency histograms. Build with
+// -DPROFILING to enable, otherwise PROFILE_SCOPE() compiles to nothing.
+
+// Bucket i counts durations of [2^i, 2^(i+1)) microseconds, the last bucket
+// everything from 2^19us (~0.5s) up
+#define PROFILER_BUCKETS 20
+
+class LatencyHistogram {
+ public:
+  void add(uint32_t us) {
+    uint8_t bucket = us == 0 ? 0 : 31 - __builtin_clz(us);
+    if (bucket >= PROFILER_BUCKETS) bucket = PROFILER_BUCKETS - 1;
+    buckets[bucket]++;
+    samples++;
+    totalUs += us;
+    if (us > maxUs) maxUs = us;
+  }
+
+  // Upper bound of the bucket holding the given percentile
+  uint32_t percentile(uint8_t percent) const {
+    if (samples == 0) return 0;
+    uint32_t target = ((uint64_t)samples * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < PROFILER_BUCKETS; i++) {
+      seen += buckets[i];
+      if (seen >= target) return min((uint32_t)2 << i, maxUs);
+    }
+    return maxUs;
+  }
+
+  uint32_t count() const { return samples; }
+  uint32_t max() const { return maxUs; }
+  uint32_t average() const { return samples ? totalUs / samples : 0; }
+  uint32_t bucket(uint8_t index) const { return buckets[index]; }
+
+  void reset() {
+    memset(buckets, 0, sizeof(buckets));
+    samples = 0;
+    totalUs = 0;
+    maxUs = 0;
+  }
+
+  String summary() const {
+    return "n=" + String(samples) + " avg=" + String(average()) +
+           " p50=" + String(percentile(50)) + " p95=" +
+           String(percentile(95)) + " max=" + String(maxUs);
+  }
+
+ private:
+  uint32_t buckets[PROFILER_BUCKETS] = {0};
+  uint32_t samples = 0;
+  uint64_t totalUs = 0;
+  uint32_t maxUs = 0;
+};
+
+class ScopedTimer {
+ public:
+  // Not the cycle counter since the CPU frequency can change mid scope, see
+  // CpuBoost.h
+  explicit ScopedTimer(LatencyHistogram& histogram)
+      : histogram(histogram), start(micros()) {}
+  ~ScopedTimer() { histogram.add(micros() - start); }
+
+ private:
+  LatencyHistogram& histogram;
+  uint32_t start;
+};
+
+enum ProfilePhase {
+  PHASE_LOOP,
+  PHASE_TOUCH,
+  PHASE_HOMIE,
+  PHASE_TASKS,
+  PHASE_DRAW,
+  PHASE_COMMIT,
+  PHASE_COUNT
+};
+
+#ifdef PROFILING
+const char* const PROFILE_PHASE_NAMES[PHASE_COUNT] = {
+    "loop", "touch", "homie", "tasks", "draw", "commit"};
+LatencyHistogram profileHistograms[PHASE_COUNT];
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(phase) \
+  ScopedTimer PROFILE_CONCAT(profileTimer, __LINE__)(profileHistograms[phase])
+#else
+#define PROFILE_SCOPE(phase)
+#endif
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <Arduino.h>
+#include <functional>
+
+#ifndef MAX_SCHEDULER_TASKS
+#define MAX_SCHEDULER_TASKS 20
+#endif
+
+typedef std::function<void()> TaskCallback;
+
+struct Task {
+  const char* name;
+  TaskCallback callback;
+  // 0 only runs when triggered
+  uint32_t periodMs;
+  // Higher runs first when several tasks are due
+  uint8_t priority;
+  // Run time in microseconds above which a run counts as an overrun, 0 for
+  // no budget
+  uint32_t budgetUs;
+  // Milliseconds after becoming due by which a run must start, 0 for none
+  uint32_t deadlineMs;
+  bool enabled;
+  bool pending;
+  uint32_t dueAt;
+
+  uint32_t runs;
+  uint32_t overruns;
+  uint32_t missedDeadlines;
+  uint32_t totalUs;
+  uint32_t maxUs;
+  uint32_t lastUs;
+};
+
+// Cooperative scheduler for work driven from loop(). At most one task runs
+// per call to run() so the display gets a frame in between heavy tasks.
+class Scheduler {
+ public:
+  Task* add(const char* name, uint32_t periodMs, TaskCallback callback,
+            uint8_t priority = 0, uint32_t budgetUs = 0,
+            uint32_t deadlineMs = 0) {
+    if (taskCount == MAX_SCHEDULER_TASKS) return nullptr;
+    Task* task = &tasks[taskCount++];
+    task->name = name;
+    task->callback = callback;
+    task->periodMs = periodMs;
+    task->priority = priority;
+    task->budgetUs = budgetUs;
+    task->deadlineMs = deadlineMs;
+    task->enabled = true;
+    task->pending = periodMs > 0;
+    task->dueAt = millis() + periodMs;
+    task->runs = 0;
+    task->overruns = 0;
+    task->missedDeadlines = 0;
+    task->totalUs = 0;
+    task->maxUs = 0;
+    task->lastUs = 0;
+    return task;
+  }
+
+  Task* find(const char* name) {
+    for (uint8_t i = 0; i < taskCount; i++) {
+      if (strcmp(tasks[i].name, name) == 0) return &tasks[i];
+    }
+    return nullptr;
+  }
+
+  // Run as soon as possible
+  void trigger(Task* task) { runIn(task, 0); }
+
+  void runIn(Task* task, uint32_t delayMs) {
+    task->dueAt = millis() + delayMs;
+    task->pending = true;
+  }
+
+  void setPeriod(Task* task, uint32_t periodMs) {
+    task->periodMs = periodMs;
+    if (periodMs > 0) runIn(task, periodMs);
+  }
+
+  // Stops one task for good, for tasks that finish their own work
+  void disable(Task* task) {
+    task->enabled = false;
+    task->pending = false;
+  }
+
+  // Stops all tasks from running until resume(), used while OTA is running
+  void suspend() { isSuspended = true; }
+  void resume() { isSuspended = false; }
+  bool suspended() const { return isSuspended; }
+
+  // Runs the most urgent due task, returns false if nothing was due
+  bool run() {
+    if (isSuspended) return false;
+    uint32_t now = millis();
+    Task* next = nullptr;
+    for (uint8_t i = 0; i < taskCount; i++) {
+      Task* task = &tasks[i];
+      if (!task->enabled || !task->pending) continue;
+      if ((int32_t)(now - task->dueAt) < 0) continue;
+      if (next == nullptr || task->priority > next->priority ||
+          (task->priority == next->priority &&
+           (int32_t)(deadline(task) - deadline(next)) < 0)) {
+        next = task;
+      }
+    }
+    if (next == nullptr) return false;
+
+    if (next->deadlineMs > 0 && (int32_t)(now - deadline(next)) > 0) {
+      next->missedDeadlines++;
+    }
+    if (next->periodMs > 0) {
+      next->dueAt += next->periodMs;
+      // Skip missed periods rather than running them back to back
+      if ((int32_t)(now - next->dueAt) >= 0) next->dueAt = now + next->periodMs;
+    } else {
+      next->pending = false;
+    }
+
+    uint32_t start = micros();
+    next->callback();
+    uint32_t elapsed = micros() - start;
+    next->runs++;
+    next->lastUs = elapsed;
+    next->totalUs += elapsed;
+    if (elapsed > next->maxUs) next->maxUs = elapsed;
+    if (next->budgetUs > 0 && elapsed > next->budgetUs) next->overruns++;
+    return true;
+  }
+
+  // Milliseconds until the next task is due, 0 if one is due now
+  uint32_t millisUntilNext() const {
+    if (isSuspended) return UINT32_MAX;
+    uint32_t now = millis();
+    uint32_t until = UINT32_MAX;
+    for (uint8_t i = 0; i < taskCount; i++) {
+      const Task& task = tasks[i];
+      if (!task.enabled || !task.pending) continue;
+      int32_t remaining = task.dueAt - now;
+      if (remaining <= 0) return 0;
+      if ((uint32_t)remaining < until) until = remaining;
+    }
+    return until;
+  }
+
+  uint8_t count() const { return taskCount; }
+  const Task& get(uint8_t index) const { return tasks[index]; }
+
+ private:
+  Task tasks[MAX_SCHEDULER_TASKS];
+  uint8_t taskCount = 0;
+  bool isSuspended = false;
+
+  static uint32_t deadline(const Task* task) {
+    return task->dueAt + task->deadlineMs;
+  }
+};
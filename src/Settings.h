@@ -13,10 +13,74 @@
 // Define data display formats
 bool IS_METRIC = true;
 bool IS_12H = true;
+// Seconds between current weather, forecast and astronomy updates
 #define UPDATE_INTERVAL 300
+#define FORECAST_UPDATE_INTERVAL 1200
+#define ASTRONOMY_UPDATE_INTERVAL 3600
+// Forecast carousel frame rate, also paces main screen redraws
+#define CAROUSEL_FPS 3
+// Automatic carousel transition time, swipes set their own until they finish
+#define CAROUSEL_TRANSITION_MS 500
+// Upper bound on redraws per second for any screen
+#define FRAME_RATE_CAP 10
+// Runtime overrides of the intervals and rates, see the tuning node
+#define TUNING_FILE "/tuning.json"
+// Records the temp_report_interval a tuned report interval overrode
+#define REPORT_INTERVAL_SETTING_KEY "report-interval-setting"
+// Longest light sleep between frames, sleeps are split into slices to check
+// for touches in between
+#define IDLE_SLEEP_MAX_MS 500
+#define IDLE_SLEEP_SLICE_MS 20
+// Seconds a touch keeps the display awake during its off hours
+#define DISPLAY_WAKE_SECONDS 30
+#define MAX_BOOT_STAGES 12
+// Pixels of travel before a touch counts as a swipe
+#define TOUCH_SWIPE_MIN_PX 40
+#define TOUCH_LONG_PRESS_MS 800
+// Carousel transition bounds, faster swipes get shorter transitions
+#define TOUCH_TRANSITION_MIN_MS 100
+#define TOUCH_TRANSITION_MAX_MS 600
+// Display message priorities, higher are shown first
+#define MESSAGE_PRIORITY 5
+#define BROADCAST_PRIORITY 1
+// Seconds a queued broadcast waits to be shown before it is dropped
+#define BROADCAST_TTL 300
+// Bytes per framebuffer snapshot MQTT message, including the 2 byte sequence
+#define SNAPSHOT_CHUNK_SIZE 512
+// Milliseconds between snapshot chunks, lets lower priority tasks run
+#define SNAPSHOT_CHUNK_GAP_MS 5
+// Samples in a recorded or replayed touch trace
+#define MAX_TOUCH_TRACE_SAMPLES 48
+// Milliseconds after a replayed trace before its latencies are published
+#define TOUCH_REPLAY_SETTLE_MS 2000
+// Seconds between the heartbeats a fetching station publishes. They go out
+// on their own timer since fetches can be up to a day apart.
+#define HUB_HEARTBEAT_INTERVAL 120
+// Seconds without a heartbeat before a follower fetches itself
+#define HUB_SILENCE_TIMEOUT (3 * HUB_HEARTBEAT_INTERVAL)
+// Milliseconds after MQTT connects for the retained hub payloads to arrive
+#define HUB_RETAINED_WAIT_MS 5000
+// Buffered telemetry records replayed per second after reconnecting
+#define TELEMETRY_REPLAY_BATCH 4
+// Largest CBOR telemetry record, a health record is about 140 bytes
+#define CBOR_RECORD_SIZE 192
+// Small files written and read back by diagnostics/storage-bench
+#define STORAGE_BENCH_FILES 8
+#define STORAGE_BENCH_FILE_SIZE 64
+// Seconds between health node publishes
+#define HEALTH_PUBLISH_INTERVAL 60
+// Seconds between loop latency publishes when built with -DPROFILING
+#define PROFILE_PUBLISH_INTERVAL 300
+// Seconds between DS18B20 samples
 #define TEMPERATURE_UPDATE 10
+// Seconds between fast samples while the Inside reading is shown
+#define TEMPERATURE_DISPLAY_UPDATE 2
+// DS18B20 resolution in bits, 9 (94ms conversion) to 12 (750ms conversion)
+#define TEMPERATURE_DISPLAY_RESOLUTION 9
+#define TEMPERATURE_TELEMETRY_RESOLUTION 12
 uint8_t allowedHours[] = {3, 15, 21};
 #define TEMPERATURE_OFFSET_C -5
+#define MAX_TEMPERATURE_PROBES 4
 
 // Define pallete
 #define MINI_BLACK 0
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#ifdef STORAGE_LITTLEFS
+#include <LittleFS.h>
+#endif
+
+// Filesystem the firmware keeps its files on. SPIFFS by default, LittleFS
+// when built with -DSTORAGE_LITTLEFS. Homie and TFTController open files
+// through the SPIFFS global, so with LittleFS storageBegin() points that
+// global at LittleFS before either of them starts.
+
+#ifdef STORAGE_LITTLEFS
+#define STORAGE_NAME "littlefs"
+#else
+#define STORAGE_NAME "spiffs"
+#endif
+
+// Files copied from SPIFFS on the first LittleFS boot. A partition holding
+// more than this stays on SPIFFS, less whatever telemetry logs do not fit.
+#define STORAGE_MIGRATE_MAX_FILES 16
+#define STORAGE_MIGRATE_MAX_BYTES 8192
+// Written to SPIFFS with the firmware version when a migration is refused,
+// so the same firmware does not try again every boot
+#define STORAGE_MIGRATE_REFUSED "/storage.refused"
+
+// Follows the SPIFFS global, so it is LittleFS once storageBegin() has run
+fs::FS& storage = SPIFFS;
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Storage.h"
+
+// Telemetry reports kept while MQTT is down, in a RAM ring that spills to a
+// flash log once full. Records come back out oldest first: the log left
+// over from the previous boot, then this boot's log, then the ring.
+
+#define TELEMETRY_RING_SIZE 32
+#define TELEMETRY_LOG "/telemetry.log"
+#define TELEMETRY_OLD_LOG "/telemetry.old"
+// Spills stop once the log reaches this, about 3.5 days of 5 minute reports
+#define TELEMETRY_LOG_MAX_BYTES 16384
+
+// at is in uptime seconds instead of epoch seconds
+#define TELEMETRY_UPTIME 0x01
+
+struct TelemetryRecord {
+  // Epoch seconds, 0 if unknown
+  uint32_t at;
+  uint8_t probe;
+  uint8_t flags;
+  // Celsius in hundredths, stddev in thousandths
+  int16_t mean;
+  int16_t min;
+  int16_t max;
+  uint16_t stddev;
+  uint16_t samples;
+};
+
+class TelemetryBuffer {
+ public:
+  // Keeps the previous boots' records apart, their uptime stamps mean
+  // nothing now
+  void begin() {
+    oldLogged = storage.exists(TELEMETRY_OLD_LOG);
+    if (!storage.exists(TELEMETRY_LOG)) return;
+    if (!oldLogged) {
+      oldLogged = storage.rename(TELEMETRY_LOG, TELEMETRY_OLD_LOG);
+      logged = !oldLogged;
+      return;
+    }
+    // Neither was replayed, keep them in order in one file
+    File from = storage.open(TELEMETRY_LOG, "r");
+    File to = storage.open(TELEMETRY_OLD_LOG, "a");
+    uint8_t buffer[64];
+    while (from && to && from.available()) {
+      size_t read = from.read(buffer, sizeof(buffer));
+      to.write(buffer, read);
+    }
+    if (from) from.close();
+    if (to) to.close();
+    storage.remove(TELEMETRY_LOG);
+  }
+
+  void add(const TelemetryRecord& record) {
+    if (length == TELEMETRY_RING_SIZE) spill();
+    ring[(head + length) % TELEMETRY_RING_SIZE] = record;
+    length++;
+  }
+
+  // Takes up to count of the oldest records, returns how many. A batch only
+  // moves on to the next source once the one before is drained.
+  uint8_t take(TelemetryRecord* out, uint8_t count) {
+    uint8_t taken =
+        takeFromLog(TELEMETRY_OLD_LOG, oldLogged, oldOffset, out, count);
+    for (uint8_t i = 0; i < taken; i++) {
+      if (out[i].flags & TELEMETRY_UPTIME) {
+        out[i].at = 0;
+        out[i].flags &= ~TELEMETRY_UPTIME;
+      }
+    }
+    if (oldLogged || taken == count) return taken;
+    taken += takeFromLog(TELEMETRY_LOG, logged, logOffset, out + taken,
+                         count - taken);
+    if (logged) return taken;
+    while (taken < count && length > 0) {
+      out[taken++] = ring[head];
+      head = (head + 1) % TELEMETRY_RING_SIZE;
+      length--;
+    }
+    return taken;
+  }
+
+  // Without touching flash, the logs are tracked as they come and go
+  bool empty() const { return length == 0 && !oldLogged && !logged; }
+
+  uint8_t buffered() const { return length; }
+  uint32_t spilled() const { return spilledCount; }
+  uint32_t dropped() const { return droppedCount; }
+
+ private:
+  TelemetryRecord ring[TELEMETRY_RING_SIZE];
+  uint8_t head = 0;
+  uint8_t length = 0;
+  uint32_t oldOffset = 0;
+  uint32_t logOffset = 0;
+  bool oldLogged = false;
+  bool logged = false;
+  uint32_t spilledCount = 0;
+  uint32_t droppedCount = 0;
+
+  // Appends the older half of the ring to the log, or drops it once the log
+  // is full
+  void spill() {
+    const uint8_t count = TELEMETRY_RING_SIZE / 2;
+    File f = storage.open(TELEMETRY_LOG, "a");
+    bool full = !f || f.size() + count * sizeof(TelemetryRecord) >
+                          TELEMETRY_LOG_MAX_BYTES;
+    for (uint8_t i = 0; i < count; i++) {
+      const TelemetryRecord& record = ring[(head + i) % TELEMETRY_RING_SIZE];
+      if (full) {
+        droppedCount++;
+      } else {
+        f.write((const uint8_t*)&record, sizeof(record));
+        spilledCount++;
+        logged = true;
+      }
+    }
+    if (f) f.close();
+    head = (head + count) % TELEMETRY_RING_SIZE;
+    length -= count;
+  }
+
+  static uint8_t takeFromLog(const char* path, bool& present,
+                             uint32_t& offset, TelemetryRecord* out,
+                             uint8_t count) {
+    if (!present) return 0;
+    File f = storage.open(path, "r");
+    if (!f) {
+      present = false;
+      return 0;
+    }
+    uint8_t taken = 0;
+    if (f.seek(offset, SeekSet)) {
+      taken = f.read((uint8_t*)out, count * sizeof(TelemetryRecord)) /
+              sizeof(TelemetryRecord);
+    }
+    offset += taken * sizeof(TelemetryRecord);
+    // A short read is the end too, a power cut can leave half a record
+    bool finished =
+        taken < count || offset + sizeof(TelemetryRecord) > f.size();
+    f.close();
+    if (finished) {
+      storage.remove(path);
+      present = false;
+      offset = 0;
+    }
+    return taken;
+  }
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Fixed size ring of samples stored as centi-degrees with a running sum and
+// monotonic min/max queues, so every add() and min/max/average query is O(1)
+// amortized. Costs 4 bytes per sample.
+template <uint8_t N>
+class HistoryTier {
+ public:
+  void add(int16_t value) {
+    if (count == N) {
+      // The oldest sample is about to be overwritten
+      sum -= samples[head];
+      if (minQueue[minFront] == head) popFront(minFront, minLength);
+      if (maxQueue[maxFront] == head) popFront(maxFront, maxLength);
+    } else {
+      count++;
+    }
+    samples[head] = value;
+    sum += value;
+
+    while (minLength > 0 &&
+           samples[back(minFront, minLength, minQueue)] >= value) {
+      minLength--;
+    }
+    pushBack(minFront, minLength, minQueue, head);
+    while (maxLength > 0 &&
+           samples[back(maxFront, maxLength, maxQueue)] <= value) {
+      maxLength--;
+    }
+    pushBack(maxFront, maxLength, maxQueue, head);
+
+    head = (head + 1) % N;
+  }
+
+  uint8_t size() const { return count; }
+  uint8_t capacity() const { return N; }
+
+  // 0 is the oldest sample
+  int16_t get(uint8_t index) const {
+    return samples[(head + N - count + index) % N];
+  }
+
+  int16_t min() const { return count ? samples[minQueue[minFront]] : 0; }
+  int16_t max() const { return count ? samples[maxQueue[maxFront]] : 0; }
+  int16_t average() const { return count ? sum / count : 0; }
+
+ private:
+  int16_t samples[N];
+  uint8_t minQueue[N];
+  uint8_t maxQueue[N];
+  int32_t sum = 0;
+  uint8_t head = 0;
+  uint8_t count = 0;
+  uint8_t minFront = 0;
+  uint8_t minLength = 0;
+  uint8_t maxFront = 0;
+  uint8_t maxLength = 0;
+
+  static uint8_t back(uint8_t front, uint8_t length, const uint8_t* queue) {
+    return queue[(front + length - 1) % N];
+  }
+
+  static void pushBack(uint8_t front, uint8_t& length, uint8_t* queue,
+                       uint8_t value) {
+    queue[(front + length) % N] = value;
+    length++;
+  }
+
+  static void popFront(uint8_t& front, uint8_t& length) {
+    front = (front + 1) % N;
+    length--;
+  }
+};
+
+// Two resolution temperature history, one sample per minute for the last two
+// hours and one averaged sample per 15 minutes for the last 48 hours.
+class TemperatureHistory {
+ public:
+  static const uint8_t COARSE_RATIO = 15;
+
+  HistoryTier<120> fine;
+  HistoryTier<192> coarse;
+
+  // Expected once a minute
+  void add(float tempC) {
+    int16_t value = lroundf(tempC * 100);
+    fine.add(value);
+    pendingSum += value;
+    if (++pendingCount == COARSE_RATIO) {
+      coarse.add(pendingSum / COARSE_RATIO);
+      pendingSum = 0;
+      pendingCount = 0;
+    }
+  }
+
+ private:
+  int32_t pendingSum = 0;
+  uint8_t pendingCount = 0;
+};
+
+// Running mean, variance (Welford), min and max over a reporting window
+class RunningStats {
+ public:
+  void add(float value) {
+    n++;
+    float delta = value - runningMean;
+    runningMean += delta / n;
+    m2 += delta * (value - runningMean);
+    if (n == 1 || value < minimum) minimum = value;
+    if (n == 1 || value > maximum) maximum = value;
+  }
+
+  void reset() {
+    n = 0;
+    runningMean = 0;
+    m2 = 0;
+  }
+
+  uint16_t count() const { return n; }
+  float mean() const { return runningMean; }
+  float min() const { return minimum; }
+  float max() const { return maximum; }
+  float stddev() const { return n > 1 ? sqrtf(m2 / n) : 0; }
+
+ private:
+  uint16_t n = 0;
+  float runningMean = 0;
+  float m2 = 0;
+  float minimum = 0;
+  float maximum = 0;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Constant per-screen touch region tables. Each table precomputes a coarse
+// grid of the regions overlapping every cell so a touch only tests the
+// handful of regions in its cell.
+
+// Grid covering the 240x320 panel
+#define TOUCH_GRID_CELL 40
+#define TOUCH_GRID_COLUMNS 6
+#define TOUCH_GRID_ROWS 8
+// Regions per table, one bit each in a grid cell
+#define MAX_TOUCH_REGIONS 8
+
+typedef void (*TouchHandler)(int16_t x, int16_t y);
+
+// Covers x1 <= x < x2, y1 <= y < y2
+struct TouchRegion {
+  int16_t x1;
+  int16_t x2;
+  int16_t y1;
+  int16_t y2;
+  TouchHandler handler;
+};
+
+class TouchTable {
+ public:
+  template <uint8_t N>
+  explicit TouchTable(const TouchRegion (&regions)[N])
+      : regions(regions), regionCount(N) {
+    static_assert(N <= MAX_TOUCH_REGIONS, "Too many touch regions");
+    memset(grid, 0, sizeof(grid));
+    for (uint8_t i = 0; i < N; i++) {
+      const TouchRegion& region = regions[i];
+      for (uint8_t row = cellRow(region.y1); row <= cellRow(region.y2 - 1);
+           row++) {
+        for (uint8_t column = cellColumn(region.x1);
+             column <= cellColumn(region.x2 - 1); column++) {
+          grid[row * TOUCH_GRID_COLUMNS + column] |= 1 << i;
+        }
+      }
+    }
+  }
+
+  // Runs the handler of the first region containing the point, earlier
+  // regions win where they overlap. Returns false if none did.
+  bool dispatch(int16_t x, int16_t y) const {
+    if (x < 0 || y < 0) return false;
+    uint8_t candidates = grid[cellRow(y) * TOUCH_GRID_COLUMNS + cellColumn(x)];
+    while (candidates) {
+      uint8_t i = __builtin_ctz(candidates);
+      candidates &= candidates - 1;
+      const TouchRegion& region = regions[i];
+      if (x >= region.x1 && x < region.x2 && y >= region.y1 &&
+          y < region.y2) {
+        region.handler(x, y);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  uint8_t size() const { return regionCount; }
+
+ private:
+  const TouchRegion* regions;
+  uint8_t regionCount;
+  uint8_t grid[TOUCH_GRID_ROWS * TOUCH_GRID_COLUMNS];
+
+  static uint8_t cellRow(int16_t y) {
+    return constrain(y / TOUCH_GRID_CELL, 0, TOUCH_GRID_ROWS - 1);
+  }
+
+  static uint8_t cellColumn(int16_t x) {
+    return constrain(x / TOUCH_GRID_CELL, 0, TOUCH_GRID_COLUMNS - 1);
+  }
+};
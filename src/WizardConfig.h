@@ -0,0 +1,85 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Storage.h"
+
+// Wizard answers in one fixed size record, read with one read and replaced
+// with one write. The record is written to a temporary file first, so a
+// power cut leaves either the old record or a complete new one.
+
+#define WIZARD_CONFIG_FILE "/wizard/config.bin"
+#define WIZARD_CONFIG_TMP_FILE "/wizard/config.tmp"
+#define WIZARD_CONFIG_MAGIC 0x47464357  // "WCFG"
+// Bump when the layout changes, older records are then ignored
+#define WIZARD_CONFIG_VERSION 1
+
+struct WizardConfig {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+  char locationId[16];
+  char locationName[32];
+  char utcOffset[8];
+  char stTime[8];
+  char dstTime[8];
+  char password[68];
+  // Over everything above
+  uint32_t crc;
+};
+static_assert(sizeof(WizardConfig) == 152, "WizardConfig layout changed");
+
+// CRC-32 as in zlib, bitwise since it runs twice per boot at most
+uint32_t wizardConfigCrc(const WizardConfig& config) {
+  const uint8_t* data = (const uint8_t*)&config;
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < offsetof(WizardConfig, crc); i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+bool readWizardConfig(const char* path, WizardConfig& config) {
+  File f = storage.open(path, "r");
+  if (!f) return false;
+  WizardConfig candidate;
+  size_t read = f.read((uint8_t*)&candidate, sizeof(candidate));
+  f.close();
+  if (read != sizeof(candidate) || candidate.magic != WIZARD_CONFIG_MAGIC ||
+      candidate.version != WIZARD_CONFIG_VERSION ||
+      candidate.size != sizeof(candidate) ||
+      candidate.crc != wizardConfigCrc(candidate)) {
+    return false;
+  }
+  config = candidate;
+  return true;
+}
+
+// A complete temporary record means the last save stopped before the rename
+bool loadWizardConfig(WizardConfig& config) {
+  if (readWizardConfig(WIZARD_CONFIG_FILE, config)) return true;
+  if (!readWizardConfig(WIZARD_CONFIG_TMP_FILE, config)) return false;
+  storage.remove(WIZARD_CONFIG_FILE);
+  storage.rename(WIZARD_CONFIG_TMP_FILE, WIZARD_CONFIG_FILE);
+  return true;
+}
+
+bool saveWizardConfig(WizardConfig& config) {
+  config.magic = WIZARD_CONFIG_MAGIC;
+  config.version = WIZARD_CONFIG_VERSION;
+  config.size = sizeof(config);
+  config.crc = wizardConfigCrc(config);
+  File f = storage.open(WIZARD_CONFIG_TMP_FILE, "w");
+  if (!f) return false;
+  size_t written = f.write((const uint8_t*)&config, sizeof(config));
+  f.close();
+  if (written != sizeof(config)) {
+    storage.remove(WIZARD_CONFIG_TMP_FILE);
+    return false;
+  }
+  // SPIFFS cannot rename over an existing file
+  storage.remove(WIZARD_CONFIG_FILE);
+  return storage.rename(WIZARD_CONFIG_TMP_FILE, WIZARD_CONFIG_FILE);
+}
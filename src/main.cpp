@@ -4,51 +4,283 @@ HomieBootMode bootMode = HomieBootMode::UNDEFINED;
 bool otaInitialDrawDone = false;
 uint8_t otaState = 0;
 uint8_t otaProgress = 0;
+uint32_t otaStartedAt = 0;
+
+// Boot timeline, published once connected and the first frame is drawn
+struct BootStage {
+  const __FlashStringHelper* name;
+  uint32_t at;
+};
+BootStage bootStages[MAX_BOOT_STAGES];
+uint8_t bootStageCount = 0;
+bool firstFrameDrawn = false;
+Task* bootTask = nullptr;
 
 uint32_t currTempRotateTime = 0;
 
-// Set initially to false to wait for WiFi before attempting update
-// These are handled outside Homie loop to ensure it still functions
-// even without an MQTT connection
+// Asynchronous DS18B20 sampling, conversions are started and collected by
+// temperatureSampleLoop() and everything else reads the cached sample
+bool temperatureConverting = false;
+uint32_t temperatureRequestedAt = 0;
+uint32_t temperatureSampledAt = 0;
+// Telemetry samples use full resolution, the on-screen reading asks for
+// quicker low resolution conversions while it is visible
+uint8_t temperatureResolution = 0;
+uint8_t conversionResolution = 0;
+bool displaySampleWanted = false;
+uint32_t displaySampledAt = 0;
+// Last measured conversion time per resolution, 9 to 12 bits
+uint16_t conversionMillis[4] = {0, 0, 0, 0};
+
+// Probes found on TEMP_PIN at startup, read by cached address afterwards.
+// Probe 0 is the "Inside" reading and keeps the original temperature node.
+struct TemperatureProbe {
+  DeviceAddress address;
+  char nodeId[16];
+  String name;
+  float offsetC;
+  // Latest sample at whatever resolution it was taken, for the display
+  float tempC;
+  // Latest full resolution sample with offset, for the report-on-change check
+  float latestC;
+  // Celsius with offset, reset after every report
+  RunningStats window;
+  float reportedC;
+  HomieNode* node;
+};
+TemperatureProbe probes[MAX_TEMPERATURE_PROBES];
+uint8_t probeCount = 0;
+uint8_t displayedProbe = 0;
+
+// History of probe 0 with offset applied, in Celsius
+TemperatureHistory temperatureHistory;
+uint32_t historySampledAt = 0;
+
+// Set once current weather, forecasts and astronomy have all been updated to
+// avoid showing unix time zero dates/temps. Updates are scheduled tasks that
+// wait for WiFi, so they still run without an MQTT connection.
 bool initialUpdate = false;
-bool doCurrentUpdate = false;
-bool doForecastUpdate = false;
-bool doAstronomyUpdate = false;
-// Set to True inititally since sending is handled inside Homie loop
-// and an MQTT connection is guarenteed
-bool doTemperatureSend = true;
-
-// Message handlers for message display
-bool messageReady = false;
-bool messageNeedsAcknowledge = false;
-String message;
-String messageTitle;
-String messageDismissButton;
+uint8_t updatedData = 0;
+#define UPDATED_CURRENT 1
+#define UPDATED_FORECASTS 2
+#define UPDATED_ASTRONOMY 4
+Task* currentTask = nullptr;
+Task* forecastTask = nullptr;
+Task* astronomyTask = nullptr;
+Task* sampleTask = nullptr;
+
+// Frames are paced so loop() can light sleep in between, see idleSleep()
+uint32_t lastFrameAt = 0;
+time_t lastFrameSecond = 0;
+uint32_t idleMillis = 0;
+uint32_t idleStatsStartedAt = 0;
+
+// Display sleep, rendering stops while asleep but tasks keep running
+bool displayAsleep = false;
+bool wakeTouchPending = false;
+uint32_t lastActivityAt = 0;
+// MQTT callbacks run in the network context, where delay() and full frame
+// SPI writes are not allowed, so they only request a change for loop()
+enum DisplayRequest { DISPLAY_KEEP, DISPLAY_WAKE, DISPLAY_SLEEP };
+DisplayRequest displayRequest = DISPLAY_KEEP;
+
+// Touch samples in screen pixels, calibrated by the touch controller. The
+// XPT2046 is only read while its pen IRQ is active. A sample with z == 0
+// marks the pen being lifted.
+struct TouchSample {
+  int16_t x;
+  int16_t y;
+  uint16_t z;
+  uint32_t at;
+};
+bool penDown = false;
+// Set once the calibration is loaded by deferredSetup()
+bool touchReady = false;
+// Pressure and time of the reading the controller is dispatching, its
+// callbacks only get the calibrated position
+uint16_t touchPressure = 0;
+uint32_t touchSampledAt = 0;
+
+// Gesture being tracked from the touch samples, in screen pixels
+struct Gesture {
+  bool active;
+  int16_t startX;
+  int16_t startY;
+  int16_t lastX;
+  int16_t lastY;
+  uint32_t startedAt;
+  bool moved;
+  bool longPressed;
+};
+Gesture gesture;
+// Set while a swipe runs its own transition speed, see onSwipe()
+bool swipedTransition = false;
+
+// Touch to photon latency of the last touch action. Total runs from the
+// finger landing to the commit, hold is the time until the sample that
+// completed the gesture, then its dispatch, the next render and the commit.
+enum TouchStage {
+  TOUCH_HOLD,
+  TOUCH_DISPATCH,
+  TOUCH_WAIT,
+  TOUCH_RENDER,
+  TOUCH_TOTAL,
+  TOUCH_STAGE_COUNT
+};
+const char* const TOUCH_STAGE_NAMES[TOUCH_STAGE_COUNT] = {
+    "hold", "dispatch", "wait", "render", "total"};
+struct TouchTiming {
+  bool pending;
+  uint32_t touchedAt;
+  uint32_t sampledAt;
+  uint32_t dispatchedAt;
+  uint32_t renderAt;
+};
+TouchTiming touchTiming;
+// Reset every time they are published
+LatencyHistogram touchLatency[TOUCH_STAGE_COUNT];
+
+// Touch trace recorded from the panel or received for replay, delays are
+// between consecutive samples and z == 0 lifts the pen
+struct TraceSample {
+  uint16_t delayMs;
+  int16_t x;
+  int16_t y;
+  uint16_t z;
+};
+enum TraceMode { TRACE_IDLE, TRACE_RECORDING, TRACE_REPLAYING };
+TraceSample touchTrace[MAX_TOUCH_TRACE_SAMPLES];
+uint8_t touchTraceLength = 0;
+uint8_t touchTraceIndex = 0;
+uint32_t touchTraceLastAt = 0;
+TraceMode touchTraceMode = TRACE_IDLE;
+Task* replayTask = nullptr;
+
+// Temperature reports are aggregated over a window, see temperatureLoop()
+bool temperatureReported = false;
+uint32_t temperatureReportedAt = 0;
+
+// Framebuffer snapshot streamed over MQTT as run length encoded chunks, see
+// tools/snapshot_to_png.py. Rendering and touch input pause while it runs.
+bool snapshotActive = false;
+String snapshotChunkTopic;
+uint32_t snapshotPixel = 0;
+uint8_t snapshotChunk[SNAPSHOT_CHUNK_SIZE];
+uint16_t snapshotChunkLength = 0;
+uint16_t snapshotSequence = 0;
+uint32_t snapshotBytes = 0;
+uint32_t snapshotStartedAt = 0;
+uint32_t snapshotMinHeap = 0;
+Task* snapshotTask = nullptr;
+
+// Intervals and rates settable on the tuning node, persisted to TUNING_FILE
+// and applied without a reboot
+struct Tuning {
+  uint32_t currentInterval;
+  uint32_t forecastInterval;
+  uint32_t astronomyInterval;
+  uint32_t sampleInterval;
+  uint32_t reportInterval;
+  uint32_t carouselFps;
+  uint32_t frameRateCap;
+};
+// The report interval defaults to the temp_report_interval setting
+Tuning tuning = {UPDATE_INTERVAL,    FORECAST_UPDATE_INTERVAL,
+                 ASTRONOMY_UPDATE_INTERVAL,
+                 TEMPERATURE_UPDATE, 0,
+                 CAROUSEL_FPS,       FRAME_RATE_CAP};
+struct TuningProperty {
+  const char* name;
+  uint32_t Tuning::*value;
+  uint32_t minimum;
+  uint32_t maximum;
+};
+// Intervals are in seconds
+const TuningProperty TUNING_PROPERTIES[] = {
+    {"current-interval", &Tuning::currentInterval, 60, 86400},
+    {"forecast-interval", &Tuning::forecastInterval, 300, 86400},
+    {"astronomy-interval", &Tuning::astronomyInterval, 600, 86400},
+    {"sample-interval", &Tuning::sampleInterval, 1, 3600},
+    // Same lower bound as the temp_report_interval setting it overrides
+    {"report-interval", &Tuning::reportInterval, TEMPERATURE_UPDATE, 86400},
+    {"carousel-fps", &Tuning::carouselFps, 1, 30},
+    {"frame-rate-cap", &Tuning::frameRateCap, 1, 30},
+};
+const uint8_t TUNING_PROPERTY_COUNT =
+    sizeof(TUNING_PROPERTIES) / sizeof(TUNING_PROPERTIES[0]);
+// Writes TUNING_FILE from loop(), the property handlers run in the network
+// context where flash writes do not belong
+Task* tuningSaveTask = nullptr;
+Task* storageBenchTask = nullptr;
+
+// Hub mode, one station fetches and shares the parsed weather as retained
+// broadcasts, followers for the same location skip HTTP
+enum HubRole { HUB_OFF, HUB_PUBLISHER, HUB_FOLLOWER };
+HubRole hubRole = HUB_OFF;
+// A follower that took over fetching after the hub went silent
+bool hubPromoted = false;
+// Any heartbeat or weather from a fetching station counts
+bool hubHeard = false;
+uint32_t hubHeardAt = 0;
+Task* hubTask = nullptr;
+// Last payloads, reapplied when the units are toggled
+String hubCurrentPayload;
+String hubForecastPayload;
+
+// Temperature reports made while MQTT is down, replayed with their original
+// time once it is back
+TelemetryBuffer telemetryBuffer;
+
+// Wire bytes and publish time per record for the text properties and the
+// optional CBOR record, reported with the scheduler stats
+struct EncodingStats {
+  uint32_t records;
+  uint32_t bytes;
+  uint32_t totalUs;
+};
+EncodingStats textEncoding = {};
+EncodingStats cborEncoding = {};
+
+// Health metrics, published every HEALTH_PUBLISH_INTERVAL
+uint32_t loopCount = 0;
+uint32_t loopCountedAt = 0;
+// Counted on connecting again, the first connect is not a reconnect
+uint16_t wifiReconnects = 0;
+uint16_t mqttReconnects = 0;
+bool wifiConnectedBefore = false;
+bool mqttConnectedBefore = false;
+uint32_t publishedCurrentFetches = 0;
+uint32_t publishedForecastFetches = 0;
+
+// Messages and broadcasts waiting to be shown, 0 when none is on screen
+MessageQueue messages;
+uint16_t shownMessageId = 0;
+// Seconds a broadcast is shown for
 uint8_t displayLength = 15;
-uint32_t displayedAt = 0;
 
 uint8_t moonAge = 0;
 String moonAgeImage = "";
-uint8_t screenCount = 5;
+uint8_t screenCount = 6;
 uint8_t currentScreen = 0;
 String tzInfo;
 uint8_t broadcastJokes = 0;
 
-// Wizard helpers
-String wizardLocId;
-String wizardLocName;
-String wizardDstTime;
-String wizardStTime;
-String wizardUtcOffset;
-// load wizard defaults
-String defaultWizardLocId;
-String defaultWizardLocName;
-String defaultWizardUtcOffset;
-String defaultwizardStTime;
-String defaultWizardDstTime;
+// Change detection for fetched weather, screens are only redrawn when their
+// bit in dirtyScreens is set (screen 0 is always redrawn for the clock)
+uint32_t currentWeatherHash = 0;
+uint32_t forecastsHash = 0;
+bool currentWeatherChanged = false;
+bool forecastsChanged = false;
+uint16_t dirtyScreens = 0xFFFF;
+
+// Wizard defaults and answers, saved once the wizard finishes
+WizardConfig wizardConfig;
 
 HomieNode temperatureNode("temperature", "temperature");
 HomieNode displayNode("display", "message");
+HomieNode diagnosticsNode("diagnostics", "diagnostics");
+HomieNode healthNode("health", "health");
+HomieNode tuningNode("tuning", "tuning");
 HomieSetting<const char*> owApiKey("ow_api_key", "Open Weather API Key");
 HomieSetting<const char*> owLocationName("ow_loc_name",
                                          "Open Weather Location Name");
@@ -61,30 +293,106 @@ HomieSetting<const char*> tzDST(
     "tz_dst", "Timezone abbrev when in Daylight Saving Time.");
 HomieSetting<const char*> tzST("tz_st",
                                "Timezone abbrev when in Standard Time.");
-
-TFTCallback nextPage(0, 50, 0, SCREEN_HEIGHT, std::bind(switchPage, true), 255);
-TFTCallback prevPage(SCREEN_WIDTH - 50, SCREEN_WIDTH, 0, SCREEN_HEIGHT,
-                     std::bind(switchPage, false), 255);
-TFTCallback toggleTempUnits(0, 160, 80, 120,
-                            [](int16_t x, int16_t y) {
-                              IS_METRIC = !IS_METRIC;
-                              updateData(true);
-                            },
-                            0);
-TFTCallback toggle24H(40, SCREEN_WIDTH - 40, 0, 80,
-                      [](int16_t x, int16_t y) { IS_12H = !IS_12H; }, 0);
-TFTCallback rebootButtonCallback(15, SCREEN_WIDTH - 15, 290, SCREEN_HEIGHT,
-                                 rebootButton, 0);
+HomieSetting<const char*> tempProbeNames(
+    "temp_probe_names", "Comma separated temperature probe names, bus order.");
+HomieSetting<const char*> tempProbeOffsets(
+    "temp_probe_offsets",
+    "Comma separated temperature probe offsets in Celsius, bus order.");
+HomieSetting<long> tempReportInterval(
+    "temp_report_interval", "Seconds between aggregated temperature reports.");
+HomieSetting<double> tempReportDelta(
+    "temp_report_delta",
+    "Report early when a probe moves this many degrees Celsius, 0 disables.");
+HomieSetting<long> cpuBoostPhases(
+    "cpu_boost_phases",
+    "Bitmask of phases run at 160MHz: 1 fetch, 2 render, 4 wizard, 8 OTA.");
+HomieSetting<long> displayIdleTimeout(
+    "display_idle_timeout",
+    "Seconds without touch before the display sleeps, 0 disables.");
+HomieSetting<long> displayOffHour(
+    "display_off_hour", "Local hour the display sleeps at, -1 disables.");
+HomieSetting<const char*> hubMode(
+    "hub_mode",
+    "off, hub or follow. Followers use the weather a hub publishes for the "
+    "same ow_loc_id.");
+HomieSetting<bool> cborTelemetry(
+    "cbor_telemetry",
+    "Also publish temperature and health records as CBOR on telemetry/cbor.");
+HomieSetting<long> displayOnHour("display_on_hour",
+                                 "Local hour the display wakes at.");
+
+void nextPageTouch(int16_t x, int16_t y) { switchPage(true); }
+void prevPageTouch(int16_t x, int16_t y) { switchPage(false); }
+
+const TouchRegion mainScreenRegions[] = {
+    {40, SCREEN_WIDTH - 40, 0, 80,
+     [](int16_t x, int16_t y) {
+       IS_12H = !IS_12H;
+       invalidateScreen(0);
+     }},
+    {0, 160, 80, 120,
+     [](int16_t x, int16_t y) {
+       IS_METRIC = !IS_METRIC;
+       updateData();
+     }},
+    {0, 50, 0, SCREEN_HEIGHT, nextPageTouch},
+    {SCREEN_WIDTH - 50, SCREEN_WIDTH, 0, SCREEN_HEIGHT, prevPageTouch},
+};
+const TouchRegion pageScreenRegions[] = {
+    {0, 50, 0, SCREEN_HEIGHT, nextPageTouch},
+    {SCREEN_WIDTH - 50, SCREEN_WIDTH, 0, SCREEN_HEIGHT, prevPageTouch},
+};
+const TouchRegion aboutScreenRegions[] = {
+    {15, SCREEN_WIDTH - 15, 290, SCREEN_HEIGHT, rebootButton},
+    {0, 50, 0, SCREEN_HEIGHT, nextPageTouch},
+    {SCREEN_WIDTH - 50, SCREEN_WIDTH, 0, SCREEN_HEIGHT, prevPageTouch},
+};
+const TouchRegion messageScreenRegions[] = {
+    {20, SCREEN_WIDTH - 20, 300, SCREEN_HEIGHT - 5, messageAcknowledge},
+    {0, 50, 0, SCREEN_HEIGHT, nextPageTouch},
+    {SCREEN_WIDTH - 50, SCREEN_WIDTH, 0, SCREEN_HEIGHT, prevPageTouch},
+};
+const TouchRegion broadcastScreenRegions[] = {
+    {20, SCREEN_WIDTH - 20, 300, SCREEN_HEIGHT - 5, broadcastDismiss},
+    {0, 50, 0, SCREEN_HEIGHT, nextPageTouch},
+    {SCREEN_WIDTH - 50, SCREEN_WIDTH, 0, SCREEN_HEIGHT, prevPageTouch},
+};
+// Shown until the first update completes
+const TouchRegion connectingRegions[] = {
+    {15, SCREEN_WIDTH - 15, 290, SCREEN_HEIGHT, rebootButton},
+};
+
+const TouchTable mainScreenTouch(mainScreenRegions);
+const TouchTable pageScreenTouch(pageScreenRegions);
+const TouchTable aboutScreenTouch(aboutScreenRegions);
+const TouchTable messageScreenTouch(messageScreenRegions);
+const TouchTable broadcastScreenTouch(broadcastScreenRegions);
+const TouchTable connectingTouch(connectingRegions);
+
+// Indexed by screen, messages (10) and broadcasts (11) are handled apart
+const TouchTable* const screenTouchTables[] = {
+    &mainScreenTouch, &pageScreenTouch,  &pageScreenTouch,
+    &pageScreenTouch, &aboutScreenTouch, &pageScreenTouch};
+const TouchTable* activeTouchTable = &connectingTouch;
+
+// Forecast carousel band on the main screen, swipes here scroll it
+const int16_t CAROUSEL_TOP = 160;
+const int16_t CAROUSEL_BOTTOM = 270;
+
+// Touches in normal mode all land here with the calibrated position and feed
+// the gesture tracking, taps go to the active table once the pen lifts
+TFTCallback screenTouchCallback(0, SCREEN_WIDTH, 0, SCREEN_HEIGHT,
+                                [](int16_t x, int16_t y) {
+                                  recordTraceSample(x, y, touchPressure);
+                                  handleTouchSample(x, y, touchPressure,
+                                                    touchSampledAt);
+                                },
+                                0);
 TFTCallback wizardTouchCallback(0, SCREEN_WIDTH, 0, SCREEN_HEIGHT,
                                 std::bind(&TFTWizard::touchCallback, &wizard,
                                           std::placeholders::_1,
                                           std::placeholders::_2),
                                 0);
-TFTCallback messageAcknowledgeCallback(20, SCREEN_WIDTH - 20, 300,
-                                       SCREEN_HEIGHT - 5, messageAcknowledge,
-                                       0);
-TFTCallback broadcastDismissCallback(20, SCREEN_WIDTH - 20, 300,
-                                     SCREEN_HEIGHT - 5, broadcastDismiss, 0);
 
 String formatDismiss(uint8_t timeLeftSeconds) {
   return "DISMISS (" + String(timeLeftSeconds) + "s)";
@@ -96,215 +404,1237 @@ void rebootButton(int16_t x, int16_t y) {
   Homie.reboot();
 }
 
+void requestDisplay(DisplayRequest request) {
+  displayRequest = request;
+  // Keeps the idle timeout from putting it straight back to sleep
+  if (request == DISPLAY_WAKE) lastActivityAt = millis();
+}
+
+void applyDisplayRequest() {
+  DisplayRequest request = displayRequest;
+  displayRequest = DISPLAY_KEEP;
+  if (request == DISPLAY_WAKE) wakeDisplay();
+  if (request == DISPLAY_SLEEP) sleepDisplay();
+}
+
+// Plain text, or {"text": "...", "title": "...", "priority": 5, "ttl": 600}
+// with ttl in seconds
 bool displayMessageHandler(const HomieRange& range, const String& value) {
   Homie.getLogger() << F("Message Recieved: ") << value << endl;
-  message = value;
-  messageTitle = "MESSAGE";
-  messageDismissButton = "ACKNOWLEDGE";
-  messageReady = true;
-  messageNeedsAcknowledge = true;
-  displayNode.setProperty("message").send(value);
-  displayNode.setProperty("acknowledged").send("false");
-  setCurrentScreenCallbacks(false);
-  currentScreen = 10;
-  setCurrentScreenCallbacks(true);
+  const char* title = "MESSAGE";
+  const char* text = value.c_str();
+  uint8_t priority = MESSAGE_PRIORITY;
+  uint32_t ttl = 0;
+  // Parsed in place, the copy is the only allocation
+  char json[MAX_MESSAGE_LENGTH + 64];
+  StaticJsonBuffer<JSON_OBJECT_SIZE(4)> jsonBuffer;
+  if (value.startsWith("{") && value.length() < sizeof(json)) {
+    strlcpy(json, value.c_str(), sizeof(json));
+    JsonObject& root = jsonBuffer.parseObject(json);
+    if (!root.success() || !root.containsKey("text")) return false;
+    text = root["text"];
+    title = root["title"] | title;
+    priority = root["priority"] | priority;
+    ttl = root["ttl"] | ttl;
+  }
+
+  uint16_t id = messages.push(title, text, priority, true, ttl * 1000);
+  publishMessageQueue();
+  if (id == 0) {
+    Homie.getLogger() << F("Message queue full, dropped") << endl;
+    return true;
+  }
+  displayNode.setProperty("message").send(text);
+  displayNode.setProperty("message-id").send(String(id));
+  showCurrentMessage();
   return true;
 }
 
+void publishMessageQueue() {
+  displayNode.setProperty("queue-depth").send(String(messages.depth()));
+  displayNode.setProperty("queue-dropped").send(String(messages.dropped()));
+}
+
+// Puts the highest priority message on screen, or returns to the main screen
+// once the queue is empty
+void showCurrentMessage() {
+  Message* shown = messages.current();
+  uint16_t id = shown ? shown->id : 0;
+  if (id == shownMessageId) return;
+  shownMessageId = id;
+  invalidateAllScreens();
+  if (shown == nullptr) {
+    setCurrentScreen(0);
+    return;
+  }
+  if (shown->needsAcknowledge) {
+    setCurrentScreen(10);
+    requestDisplay(DISPLAY_WAKE);
+  } else {
+    setCurrentScreen(11);
+  }
+}
+
+void expireMessages() {
+  // Messages without a button are dismissed once their display time is up,
+  // counted from when they were first drawn on a lit screen
+  Message* shown = messages.find(shownMessageId);
+  if (shown != nullptr && !shown->needsAcknowledge && shown->shownAt != 0 &&
+      millis() - shown->shownAt >= displayLength * 1000) {
+    broadcastDismiss(0, 0);
+  }
+  uint16_t id = messages.expire();
+  if (id == 0) return;
+  displayNode.setProperty("expired").send(String(id));
+  publishMessageQueue();
+  showCurrentMessage();
+}
+
+bool displayAwakeHandler(const HomieRange& range, const String& value) {
+  if (value.equals("true")) {
+    requestDisplay(DISPLAY_WAKE);
+  } else if (value.equals("false")) {
+    requestDisplay(DISPLAY_SLEEP);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void sleepDisplay() {
+  if (displayAsleep) return;
+  gfx.fillBuffer(MINI_BLACK);
+  gfx.commit();
+  tft.writecommand(ILI9341_DISPOFF);
+  tft.writecommand(ILI9341_SLPIN);
+  displayAsleep = true;
+  Homie.getLogger() << F("Display asleep") << endl;
+  displayNode.setProperty("awake").send("false");
+}
+
+void wakeDisplay() {
+  lastActivityAt = millis();
+  if (!displayAsleep) return;
+  tft.writecommand(ILI9341_SLPOUT);
+  // The controller needs 5ms after leaving sleep before the next command
+  delay(5);
+  tft.writecommand(ILI9341_DISPON);
+  displayAsleep = false;
+  invalidateAllScreens();
+  Homie.getLogger() << F("Display awake") << endl;
+  displayNode.setProperty("awake").send("true");
+}
+
+bool inDisplayOffHours() {
+  long offHour = displayOffHour.get();
+  long onHour = displayOnHour.get();
+  if (offHour < 0 || onHour < 0 || offHour == onHour) return false;
+  time_t now = time(nullptr);
+  int hour = localtime(&now)->tm_hour;
+  if (offHour < onHour) return hour >= offHour && hour < onHour;
+  // Window wraps around midnight
+  return hour >= offHour || hour < onHour;
+}
+
+void updateDisplaySleep() {
+  if (displayAsleep || penDown) return;
+
+  // Inside the off hours a touch keeps it awake for a while
+  long timeout = displayIdleTimeout.get();
+  uint32_t awakeFor = (timeout > 0 ? timeout : DISPLAY_WAKE_SECONDS) * 1000;
+  bool idle = millis() - lastActivityAt >= awakeFor;
+  if (idle && (timeout > 0 || inDisplayOffHours())) sleepDisplay();
+}
+
+void sampleTouch() {
+  // The IRQ flag is set by the library's pen interrupt and cleared once a
+  // read sees the pen lifted, no SPI traffic while nobody touches the screen
+  if (!touchReady || !ts.tirqTouched()) return;
+  if (ts.touched()) {
+    // Cached by the library, this does not read the controller again
+    TS_Point point = ts.getPoint();
+    touchPressure = max(point.z, (int16_t)1);
+    touchSampledAt = micros();
+    penDown = true;
+    // Calibrates the cached point and calls back, see screenTouchCallback
+    touchController.loop();
+  } else if (penDown) {
+    handleTouchSample(0, 0, 0, micros());
+    recordTraceSample(0, 0, 0);
+    penDown = false;
+  }
+}
+
+void handleTouchSample(int16_t x, int16_t y, uint16_t z, uint32_t at) {
+  TouchSample sample = {x, y, z, at};
+  // Touch actions can draw progress screens into the framebuffer a snapshot
+  // is reading, so they are dropped until it is done
+  if (snapshotActive) {
+    gesture.active = false;
+    if (sample.z == 0) wakeTouchPending = false;
+    return;
+  }
+  if (sample.z == 0) {
+    if (!wakeTouchPending) endGesture(sample);
+    wakeTouchPending = false;
+    return;
+  }
+  // Swallow the touch that wakes the display until the pen is lifted
+  if (displayAsleep) wakeTouchPending = true;
+  wakeDisplay();
+  if (wakeTouchPending) return;
+  trackGesture(sample);
+}
+
+void trackGesture(const TouchSample& sample) {
+  // Gestures drive the screens, the wizard takes its own callbacks
+  if (bootMode != HomieBootMode::NORMAL) return;
+  int16_t x = sample.x;
+  int16_t y = sample.y;
+  if (!gesture.active) {
+    gesture.active = true;
+    gesture.startX = x;
+    gesture.startY = y;
+    gesture.startedAt = sample.at;
+    gesture.moved = false;
+    gesture.longPressed = false;
+  }
+  gesture.lastX = x;
+  gesture.lastY = y;
+  if (abs(x - gesture.startX) >= TOUCH_SWIPE_MIN_PX ||
+      abs(y - gesture.startY) >= TOUCH_SWIPE_MIN_PX) {
+    gesture.moved = true;
+  }
+  if (!gesture.moved && !gesture.longPressed &&
+      (sample.at - gesture.startedAt) / 1000 >= TOUCH_LONG_PRESS_MS) {
+    gesture.longPressed = true;
+    onLongPress(sample.at);
+  }
+}
+
+void endGesture(const TouchSample& sample) {
+  if (!gesture.active) return;
+  gesture.active = false;
+  if (gesture.longPressed) return;
+  if (!gesture.moved) {
+    markTouchAction(gesture.startedAt, sample.at);
+    if (!activeTouchTable->dispatch(gesture.startX, gesture.startY)) {
+      touchTiming.pending = false;
+    }
+    return;
+  }
+  int16_t dx = gesture.lastX - gesture.startX;
+  int16_t dy = gesture.lastY - gesture.startY;
+  uint32_t duration =
+      max((sample.at - gesture.startedAt) / 1000, (uint32_t)1);
+  uint32_t distance = max(abs(dx), abs(dy));
+  markTouchAction(gesture.startedAt, sample.at);
+  onSwipe(dx, dy, distance * 1000 / duration);
+}
+
+void onSwipe(int16_t dx, int16_t dy, uint32_t pixelsPerSecond) {
+  if (!initialUpdate) return;
+  bool horizontal = abs(dx) >= abs(dy);
+  Homie.getLogger() << F("Swipe ") << (horizontal ? F("x=") : F("y="))
+                    << (horizontal ? dx : dy) << F(" at ") << pixelsPerSecond
+                    << F("px/s") << endl;
+  if (!horizontal) {
+    switchPage(dy < 0);
+    return;
+  }
+  if (currentScreen == 0 && shownMessageId == 0 &&
+      gesture.startY >= CAROUSEL_TOP && gesture.startY < CAROUSEL_BOTTOM) {
+    // Time the slide would take to cross the screen at the swipe's speed
+    uint32_t transitionMs =
+        SCREEN_WIDTH * 1000 / max(pixelsPerSecond, (uint32_t)1);
+    carousel.setTimePerTransition(constrain(
+        transitionMs, TOUCH_TRANSITION_MIN_MS, TOUCH_TRANSITION_MAX_MS));
+    swipedTransition = true;
+    if (dx < 0) {
+      carousel.nextFrame();
+    } else {
+      carousel.previousFrame();
+    }
+    return;
+  }
+  switchPage(dx < 0);
+}
+
+void onLongPress(uint32_t at) {
+  // Forces a refresh of everything, from the scheduler since the fetches
+  // block for seconds
+  if (!initialUpdate || shownMessageId != 0) return;
+  Homie.getLogger() << F("Long press, refreshing") << endl;
+  markTouchAction(gesture.startedAt, at);
+  scheduler.trigger(currentTask);
+  scheduler.trigger(forecastTask);
+  scheduler.trigger(astronomyTask);
+}
+
+void markTouchAction(uint32_t touchedAt, uint32_t sampledAt) {
+  touchTiming.pending = true;
+  touchTiming.touchedAt = touchedAt;
+  touchTiming.sampledAt = sampledAt;
+  touchTiming.dispatchedAt = micros();
+  touchTiming.renderAt = 0;
+}
+
+void recordTouchTiming() {
+  uint32_t now = micros();
+  touchLatency[TOUCH_HOLD].add(touchTiming.sampledAt - touchTiming.touchedAt);
+  touchLatency[TOUCH_DISPATCH].add(touchTiming.dispatchedAt -
+                                   touchTiming.sampledAt);
+  touchLatency[TOUCH_WAIT].add(touchTiming.renderAt - touchTiming.dispatchedAt);
+  touchLatency[TOUCH_RENDER].add(now - touchTiming.renderAt);
+  touchLatency[TOUCH_TOTAL].add(now - touchTiming.touchedAt);
+  touchTiming.pending = false;
+}
+
+String formatTouchLatency() {
+  String latency;
+  for (uint8_t i = 0; i < TOUCH_STAGE_COUNT; i++) {
+    if (i > 0) latency += " | ";
+    latency += String(TOUCH_STAGE_NAMES[i]) + ": " + touchLatency[i].summary();
+  }
+  return latency;
+}
+
+void resetTouchLatency() {
+  for (uint8_t i = 0; i < TOUCH_STAGE_COUNT; i++) touchLatency[i].reset();
+}
+
+void recordTraceSample(int16_t x, int16_t y, uint16_t z) {
+  if (touchTraceMode != TRACE_RECORDING) return;
+  // Wait for the pen to go down before recording
+  if (touchTraceLength == 0 && z == 0) return;
+  uint32_t now = millis();
+  TraceSample& sample = touchTrace[touchTraceLength++];
+  sample.delayMs = touchTraceLength == 1 ? 0 : now - touchTraceLastAt;
+  sample.x = x;
+  sample.y = y;
+  sample.z = z;
+  touchTraceLastAt = now;
+  // One gesture per recording
+  if (z != 0 && touchTraceLength < MAX_TOUCH_TRACE_SAMPLES) return;
+
+  String trace;
+  for (uint8_t i = 0; i < touchTraceLength; i++) {
+    const TraceSample& recorded = touchTrace[i];
+    trace += String(recorded.delayMs) + "," + String(recorded.x) + "," +
+             String(recorded.y) + "," + String(recorded.z) + ";";
+  }
+  touchTraceMode = TRACE_IDLE;
+  Homie.getLogger() << F("Touch trace recorded: ") << touchTraceLength
+                    << F(" samples") << endl;
+  diagnosticsNode.setProperty("touch-trace").send(trace);
+}
+
+// Parses "delay,x,y,z;delay,x,y,z;..." into touchTrace
+bool parseTouchTrace(const String& value) {
+  const char* cursor = value.c_str();
+  touchTraceLength = 0;
+  while (*cursor) {
+    if (touchTraceLength == MAX_TOUCH_TRACE_SAMPLES) return false;
+    long fields[4];
+    for (uint8_t i = 0; i < 4; i++) {
+      char* end;
+      fields[i] = strtol(cursor, &end, 10);
+      if (end == cursor) return false;
+      cursor = end;
+      if (i < 3 && *cursor++ != ',') return false;
+    }
+    if (*cursor == ';') {
+      cursor++;
+    } else if (*cursor) {
+      return false;
+    }
+    TraceSample& sample = touchTrace[touchTraceLength++];
+    sample.delayMs = fields[0];
+    sample.x = fields[1];
+    sample.y = fields[2];
+    sample.z = fields[3];
+  }
+  return touchTraceLength > 0;
+}
+
+bool touchTraceHandler(const HomieRange& range, const String& value) {
+  if (!initialUpdate || touchTraceMode != TRACE_IDLE) return false;
+  if (value.equals("record")) {
+    touchTraceLength = 0;
+    touchTraceMode = TRACE_RECORDING;
+    Homie.getLogger() << F("Recording the next touch") << endl;
+    return true;
+  }
+  if (!parseTouchTrace(value)) return false;
+  // The replay gets a fresh window
+  resetTouchLatency();
+  touchTraceIndex = 0;
+  touchTraceMode = TRACE_REPLAYING;
+  scheduler.runIn(replayTask, touchTrace[0].delayMs);
+  Homie.getLogger() << F("Replaying ") << touchTraceLength
+                    << F(" touch samples") << endl;
+  return true;
+}
+
+// Feeds the trace into the touch handling with its original timing, then
+// publishes the latencies it produced
+void replayTouchTrace() {
+  if (touchTraceIndex < touchTraceLength) {
+    const TraceSample& sample = touchTrace[touchTraceIndex++];
+    handleTouchSample(sample.x, sample.y, sample.z, micros());
+    scheduler.runIn(replayTask, touchTraceIndex < touchTraceLength
+                                    ? touchTrace[touchTraceIndex].delayMs
+                                    : TOUCH_REPLAY_SETTLE_MS);
+    return;
+  }
+  touchTraceMode = TRACE_IDLE;
+  String latency = formatTouchLatency();
+  Homie.getLogger() << F("Touch replay: ") << latency << endl;
+  diagnosticsNode.setProperty("touch-replay").send(latency);
+}
+
+String snapshotTopic(const char* suffix) {
+  return String(Homie.getConfiguration().mqtt.baseTopic) +
+         Homie.getConfiguration().deviceId + "/diagnostics/snapshot/" + suffix;
+}
+
+bool snapshotHandler(const HomieRange& range, const String& value) {
+  if (!value.equals("true") || snapshotActive || !initialUpdate) return false;
+  snapshotActive = true;
+  snapshotPixel = 0;
+  snapshotChunkLength = 0;
+  snapshotSequence = 0;
+  snapshotBytes = 0;
+  snapshotStartedAt = millis();
+  snapshotMinHeap = ESP.getFreeHeap();
+  // Width, height, bits per pixel and the RGB565 palette
+  String info = String(SCREEN_WIDTH) + "," + String(SCREEN_HEIGHT) + "," +
+                String(BITS_PER_PIXEL);
+  for (uint8_t i = 0; i < (1 << BITS_PER_PIXEL); i++) {
+    info += "," + String(palette[i]);
+  }
+  Homie.getMqttClient().publish(snapshotTopic("info").c_str(), 1, false,
+                                info.c_str());
+  snapshotChunkTopic = snapshotTopic("chunk");
+  scheduler.trigger(snapshotTask);
+  Homie.getLogger() << F("Snapshot started") << endl;
+  return true;
+}
+
+// Each byte is a run of up to 64 pixels, the pixel in the top two bits and
+// the run length - 1 in the rest
+void fillSnapshotChunk() {
+  static_assert(BITS_PER_PIXEL == 2, "Snapshot encoding assumes 2bpp");
+  const uint32_t pixels = (uint32_t)SCREEN_WIDTH * SCREEN_HEIGHT;
+  snapshotChunk[0] = snapshotSequence >> 8;
+  snapshotChunk[1] = snapshotSequence & 0xFF;
+  snapshotChunkLength = 2;
+  while (snapshotPixel < pixels && snapshotChunkLength < SNAPSHOT_CHUNK_SIZE) {
+    uint8_t value = snapshotPixelAt(snapshotPixel);
+    uint8_t run = 1;
+    while (run < 64 && snapshotPixel + run < pixels &&
+           snapshotPixelAt(snapshotPixel + run) == value) {
+      run++;
+    }
+    snapshotChunk[snapshotChunkLength++] = value << 6 | (run - 1);
+    snapshotPixel += run;
+  }
+}
+
+uint8_t snapshotPixelAt(uint32_t pixel) {
+  return gfx.getPixel(pixel % SCREEN_WIDTH, pixel / SCREEN_WIDTH);
+}
+
+// Publishes one chunk per run, encoded straight from the framebuffer
+void snapshotLoop() {
+  if (!snapshotActive) return;
+  if (!Homie.isConnected()) {
+    Homie.getLogger() << F("Snapshot aborted, disconnected") << endl;
+    snapshotActive = false;
+    return;
+  }
+  // A chunk that did not fit in the TCP buffer is retried as is
+  if (snapshotChunkLength == 0) fillSnapshotChunk();
+  if (Homie.getMqttClient().publish(snapshotChunkTopic.c_str(), 0, false,
+                                    (const char*)snapshotChunk,
+                                    snapshotChunkLength) == 0) {
+    scheduler.runIn(snapshotTask, 20);
+    return;
+  }
+  snapshotBytes += snapshotChunkLength - 2;
+  snapshotSequence++;
+  snapshotChunkLength = 0;
+  snapshotMinHeap = min(snapshotMinHeap, ESP.getFreeHeap());
+  if (snapshotPixel < (uint32_t)SCREEN_WIDTH * SCREEN_HEIGHT) {
+    scheduler.runIn(snapshotTask, SNAPSHOT_CHUNK_GAP_MS);
+    return;
+  }
+
+  snapshotActive = false;
+  invalidateAllScreens();
+  String result = "chunks=" + String(snapshotSequence) +
+                  " bytes=" + String(snapshotBytes) +
+                  " ms=" + String(millis() - snapshotStartedAt) +
+                  " minheap=" + String(snapshotMinHeap);
+  Homie.getLogger() << F("Snapshot done: ") << result << endl;
+  diagnosticsNode.setProperty("snapshot").send(result);
+}
+
 void messageAcknowledge(int16_t x, int16_t y) {
   drawProgress(50, F("Acknowledging..."));
+  uint16_t id = shownMessageId;
   broadcastDismiss(x, y);
-  displayNode.setProperty("acknowledged").send("true");
+  displayNode.setProperty("acknowledged").send(String(id));
 }
 
 void broadcastDismiss(int16_t x, int16_t y) {
-  message = "";
-  setCurrentScreenCallbacks(false);
-  currentScreen = 0;
-  setCurrentScreenCallbacks(true);
+  messages.remove(shownMessageId);
+  publishMessageQueue();
+  showCurrentMessage();
 }
 
 bool broadcastHandler(const String& level, const String& value) {
-  uint16_t lastDisplaySec = (millis() - displayedAt) / 1000;
-  if (displayedAt == 0 || lastDisplaySec > 60) {
-    if (level.equals("dadjoke") && broadcastJokes == 0) {
-      message = value;
-    } else if (level.equals("chuckjoke") && broadcastJokes == 1) {
-      message = value;
-    } else if (level.equals("catfact") && broadcastJokes == 2) {
-      message = value;
-    } else {
-      return false;
-    }
-  } else {
+  if (level.startsWith("weather-")) return hubBroadcastHandler(level, value);
+  if (!(level.equals("dadjoke") && broadcastJokes == 0) &&
+      !(level.equals("chuckjoke") && broadcastJokes == 1) &&
+      !(level.equals("catfact") && broadcastJokes == 2)) {
     return false;
   }
-  messageTitle = "BROADCAST";
-  messageDismissButton = formatDismiss(displayLength);
-  messageReady = true;
-  messageNeedsAcknowledge = false;
-  setCurrentScreenCallbacks(false);
-  currentScreen = 11;
-  setCurrentScreenCallbacks(true);
+  // Queued behind any unacknowledged message rather than replacing it
+  messages.push("BROADCAST", value.c_str(), BROADCAST_PRIORITY, false,
+                BROADCAST_TTL * 1000);
+  publishMessageQueue();
+  showCurrentMessage();
   broadcastJokes = (broadcastJokes + 1) % 3;
   return true;
 }
 
-void setCurrentScreenCallbacks(bool enabled) {
-  switch (currentScreen) {
-    // going back on screen 0 has a happy side effect of making the
-    // currentScreen 255, however all this causes is you need to press back
-    // twice, and it works fine otherwise
-    case 255:
-    case 0:
-      toggle24H.setEnabled(enabled);
-      toggleTempUnits.setEnabled(enabled);
-      break;
-    case 4:
-      rebootButtonCallback.setEnabled(enabled);
-      break;
-    case 10:
-      messageAcknowledgeCallback.setEnabled(enabled);
-    case 11:
-      broadcastDismissCallback.setEnabled(enabled);
-    default:
-      break;
+void invalidateScreen(uint8_t screen) {
+  if (screen < 16) dirtyScreens |= 1 << screen;
+}
+
+void invalidateAllScreens() { dirtyScreens = 0xFFFF; }
+
+void setCurrentScreen(uint8_t screen) {
+  currentScreen = screen;
+  // The reset button stays active until the first update completes
+  if (!initialUpdate) return;
+  if (screen == 10) {
+    activeTouchTable = &messageScreenTouch;
+  } else if (screen == 11) {
+    activeTouchTable = &broadcastScreenTouch;
+  } else {
+    activeTouchTable = screenTouchTables[screen];
   }
 }
 
 void switchPage(bool forward) {
-  setCurrentScreenCallbacks(false);
   if (forward) {
-    currentScreen = (currentScreen + 1) % screenCount;
+    setCurrentScreen((currentScreen + 1) % screenCount);
   } else {
-    currentScreen = (currentScreen - 1) % screenCount;
+    setCurrentScreen((currentScreen + screenCount - 1) % screenCount);
   }
-  setCurrentScreenCallbacks(true);
+  invalidateScreen(currentScreen);
   Homie.getLogger() << F("Current Screen: ") << currentScreen << endl;
 }
 
 void initialize() {
-  temperatureNode.setProperty("unit").send(IS_METRIC ? "c" : "f");
+  for (uint8_t i = 0; i < probeCount; i++) {
+    probes[i].node->setProperty("unit").send(IS_METRIC ? "c" : "f");
+    probes[i].node->setProperty("name").send(probes[i].name);
+  }
+  displayNode.setProperty("awake").send(displayAsleep ? "false" : "true");
+  for (uint8_t i = 0; i < TUNING_PROPERTY_COUNT; i++) {
+    const TuningProperty& property = TUNING_PROPERTIES[i];
+    tuningNode.setProperty(property.name)
+        .send(String(tuning.*property.value));
+  }
 }
 
-void temperatureLoop() {
-  if (doTemperatureSend) {
-    sensors.requestTemperatures();
+bool storageBegin() {
+#ifdef STORAGE_LITTLEFS
+  // Keeps the SPIFFS implementation around for the migration
+  fs::FS legacy = SPIFFS;
+  SPIFFS = LittleFS;
+  LittleFSConfig config;
+  config.setAutoFormat(false);
+  LittleFS.setConfig(config);
+  if (LittleFS.begin()) return true;
+  // First boot on LittleFS, the partition still holds SPIFFS
+  if (migrateFromSpiffs(legacy)) return LittleFS.begin();
+  // Left mounted by the refused migration
+  SPIFFS = legacy;
+  return true;
+#else
+  return SPIFFS.begin();
+#endif
+}
+
+#ifdef STORAGE_LITTLEFS
+// Both filesystems use the same partition, so the files are held in RAM
+// while it is formatted. Nothing is formatted unless every file fits, the
+// partition is left on SPIFFS, still mounted, otherwise. The telemetry logs
+// are only carried if there is room left after everything else.
+bool migrateFromSpiffs(fs::FS& legacy) {
+  struct MigratedFile {
+    String path;
+    uint8_t* data;
+    size_t size;
+  };
+  MigratedFile files[STORAGE_MIGRATE_MAX_FILES];
+  uint8_t count = 0;
+  size_t total = 0;
+  bool complete = true;
+  uint32_t startedAt = millis();
+
+  SPIFFSConfig config;
+  config.setAutoFormat(false);
+  legacy.setConfig(config);
+  if (legacy.begin()) {
+    // Refused before by this firmware, a new one tries again
+    File marker = legacy.open(STORAGE_MIGRATE_REFUSED, "r");
+    if (marker) {
+      bool refused = marker.readString().equals(VERSION);
+      marker.close();
+      if (refused) return false;
+    }
+    for (uint8_t pass = 0; pass < 2 && complete; pass++) {
+      Dir dir = legacy.openDir("/");
+      while (complete && dir.next()) {
+        String path = dir.fileName();
+        bool telemetry = path.equals(TELEMETRY_LOG) ||
+                         path.equals(TELEMETRY_OLD_LOG);
+        if (telemetry != (pass == 1) || path.equals(STORAGE_MIGRATE_REFUSED)) {
+          continue;
+        }
+        size_t size = dir.fileSize();
+        uint8_t* data = nullptr;
+        if (count < STORAGE_MIGRATE_MAX_FILES &&
+            total + size <= STORAGE_MIGRATE_MAX_BYTES) {
+          data = (uint8_t*)malloc(max(size, (size_t)1));
+        }
+        File f;
+        if (data != nullptr) f = dir.openFile("r");
+        if (!f || f.read(data, size) != size) {
+          free(data);
+          if (telemetry) {
+            Homie.getLogger() << F("Dropping ") << path << endl;
+          } else {
+            Homie.getLogger() << F("Cannot migrate ") << path << endl;
+            complete = false;
+          }
+          continue;
+        }
+        f.close();
+        files[count++] = {path, data, size};
+        total += size;
+      }
+    }
+    if (!complete) {
+      for (uint8_t i = 0; i < count; i++) free(files[i].data);
+      File marker = legacy.open(STORAGE_MIGRATE_REFUSED, "w");
+      if (marker) {
+        marker.print(VERSION);
+        marker.close();
+      }
+      Homie.getLogger() << F("Staying on SPIFFS") << endl;
+      return false;
+    }
+    legacy.end();
+  }
 
-    float insideTemp = IS_METRIC
-                           ? (sensors.getTempCByIndex(0) + TEMPERATURE_OFFSET_C)
-                           : sensors.getTempFByIndex(0);
-    Homie.getLogger() << F("Temperature: ") << insideTemp << endl;
-    temperatureNode.setProperty("degrees").send(String(insideTemp));
-    doTemperatureSend = false;
+  LittleFS.format();
+  LittleFS.begin();
+  uint8_t failed = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    // LittleFS creates the directories in the path
+    File f = LittleFS.open(files[i].path, "w");
+    size_t written = f ? f.write(files[i].data, files[i].size) : 0;
+    if (f) f.close();
+    if (written != files[i].size) {
+      Homie.getLogger() << F("Failed to migrate ") << files[i].path << endl;
+      failed++;
+    }
+    free(files[i].data);
   }
+  LittleFS.end();
+  Homie.getLogger() << F("Migrated ") << count - failed << F(" files, ")
+                    << total << F(" bytes from SPIFFS in ")
+                    << millis() - startedAt << F("ms") << endl;
+  return true;
 }
-
-void loadWizardDefaults() {
-  drawProgress(15, F("Initializing System..."));
-  File f = SPIFFS.open("/wizard/location_id.txt", "r");
-  if (!f) {
-    defaultWizardLocId = DEFAULT_WIZARD_LOCATION_ID;
-  } else {
-    defaultWizardLocId = f.readString();
+#endif
+
+// Writes, then opens and reads back, a few small files. The open and read
+// averages are what config and calibration loads pay at boot.
+String benchmarkStorage() {
+  uint8_t data[STORAGE_BENCH_FILE_SIZE];
+  memset(data, 0x5A, sizeof(data));
+  uint32_t writeUs = 0;
+  uint32_t openUs = 0;
+  uint32_t readUs = 0;
+  uint8_t failed = 0;
+  for (uint8_t i = 0; i < STORAGE_BENCH_FILES; i++) {
+    uint32_t startedAt = micros();
+    File f = storage.open("/bench/" + String(i), "w");
+    if (!f || f.write(data, sizeof(data)) != sizeof(data)) failed++;
+    if (f) f.close();
+    writeUs += micros() - startedAt;
   }
-  Homie.getLogger() << F("loaded defaultWizardLocId=") << defaultWizardLocId
-                    << endl;
+  for (uint8_t i = 0; i < STORAGE_BENCH_FILES; i++) {
+    uint32_t startedAt = micros();
+    File f = storage.open("/bench/" + String(i), "r");
+    uint32_t openedAt = micros();
+    if (!f || f.read(data, sizeof(data)) != sizeof(data)) failed++;
+    if (f) f.close();
+    openUs += openedAt - startedAt;
+    readUs += micros() - openedAt;
+  }
+  for (uint8_t i = 0; i < STORAGE_BENCH_FILES; i++) {
+    storage.remove("/bench/" + String(i));
+  }
+  return String(STORAGE_NAME) + ": files=" + String(STORAGE_BENCH_FILES) +
+         " size=" + String(STORAGE_BENCH_FILE_SIZE) + " write=" +
+         String(writeUs / STORAGE_BENCH_FILES) + "us open=" +
+         String(openUs / STORAGE_BENCH_FILES) + "us read=" +
+         String(readUs / STORAGE_BENCH_FILES) + "us failed=" + String(failed);
+}
+
+void publishStorageBench() {
+  String result = benchmarkStorage();
+  Homie.getLogger() << F("Storage benchmark ") << result << endl;
+  diagnosticsNode.setProperty("storage-bench").send(result);
+}
+
+// Runs in the network context, the benchmark itself runs from loop()
+bool storageBenchHandler(const HomieRange& range, const String& value) {
+  if (!value.equals("true")) return false;
+  scheduler.trigger(storageBenchTask);
+  return true;
+}
+
+void loadTuning() {
+  tuning.reportInterval = tempReportInterval.get();
+  File f = storage.open(TUNING_FILE, "r");
+  if (!f) return;
+  StaticJsonBuffer<512> jsonBuffer;
+  JsonObject& root = jsonBuffer.parseObject(f);
   f.close();
-  drawProgress(30, F("Feeding the hamsters..."));
-  f = SPIFFS.open("/wizard/location_name.txt", "r");
-  if (!f) {
-    defaultWizardLocName = DEFAULT_WIZARD_LOCATION_NAME;
+  if (!root.success()) {
+    Homie.getLogger() << F("Ignoring unreadable ") << TUNING_FILE << endl;
+    return;
+  }
+  // A report interval tuned over MQTT only holds until the
+  // temp_report_interval setting it overrode is changed
+  long setting = root[REPORT_INTERVAL_SETTING_KEY];
+  if (setting != tempReportInterval.get()) {
+    root.remove("report-interval");
+  }
+  for (uint8_t i = 0; i < TUNING_PROPERTY_COUNT; i++) {
+    const TuningProperty& property = TUNING_PROPERTIES[i];
+    uint32_t value = root[property.name] | tuning.*property.value;
+    tuning.*property.value =
+        constrain(value, property.minimum, property.maximum);
+  }
+}
+
+void saveTuning() {
+  StaticJsonBuffer<JSON_OBJECT_SIZE(TUNING_PROPERTY_COUNT + 1)> jsonBuffer;
+  JsonObject& root = jsonBuffer.createObject();
+  for (uint8_t i = 0; i < TUNING_PROPERTY_COUNT; i++) {
+    const TuningProperty& property = TUNING_PROPERTIES[i];
+    root[property.name] = tuning.*property.value;
+  }
+  // The setting stays the source of the report interval unless tuned away
+  // from it, see loadTuning()
+  long setting = tempReportInterval.get();
+  if (tuning.reportInterval == (uint32_t)setting) {
+    root.remove("report-interval");
   } else {
-    defaultWizardLocName = f.readString();
+    root[REPORT_INTERVAL_SETTING_KEY] = setting;
   }
-  Homie.getLogger() << F("loaded defaultWizardLocName=") << defaultWizardLocName
-                    << endl;
-  f.close();
-  drawProgress(45, F("Loading..."));
-  f = SPIFFS.open("/wizard/utc_offset.txt", "r");
+  File f = storage.open(TUNING_FILE, "w");
   if (!f) {
-    defaultWizardUtcOffset = DEFAULT_WIZARD_UTC_OFFSET;
-  } else {
-    defaultWizardUtcOffset = f.readString();
+    Homie.getLogger() << F("Failed to write ") << TUNING_FILE << endl;
+    return;
   }
-  Homie.getLogger() << F("loaded defaultWizardUtcOffset=")
-                    << defaultWizardUtcOffset << endl;
+  root.printTo(f);
   f.close();
-  drawProgress(60, F("Loading..."));
-  f = SPIFFS.open("/wizard/st_time.txt", "r");
-  if (!f) {
-    defaultwizardStTime = DEFAULT_WIZARD_ST_TIME;
-  } else {
-    defaultwizardStTime = f.readString();
+}
+
+// Only reschedules tasks whose period actually changed
+void applyTuning() {
+  if (currentTask->periodMs != tuning.currentInterval * 1000) {
+    scheduler.setPeriod(currentTask, tuning.currentInterval * 1000);
   }
-  Homie.getLogger() << F("loaded defaultwizardStTime=") << defaultwizardStTime
+  if (forecastTask->periodMs != tuning.forecastInterval * 1000) {
+    scheduler.setPeriod(forecastTask, tuning.forecastInterval * 1000);
+  }
+  if (astronomyTask->periodMs != tuning.astronomyInterval * 1000) {
+    scheduler.setPeriod(astronomyTask, tuning.astronomyInterval * 1000);
+  }
+  // The next sample is rescheduled from the new interval
+  if (!temperatureConverting) scheduler.trigger(sampleTask);
+  carousel.setTargetFPS(tuning.carouselFps);
+}
+
+bool tuningHandler(uint8_t index, const String& value) {
+  const TuningProperty& property = TUNING_PROPERTIES[index];
+  long candidate = value.toInt();
+  if (candidate < (long)property.minimum ||
+      candidate > (long)property.maximum) {
+    return false;
+  }
+  tuning.*property.value = candidate;
+  Homie.getLogger() << F("Tuning ") << property.name << F(" = ") << candidate
                     << endl;
-  f.close();
-  drawProgress(75, F("Still loading..."));
-  f = SPIFFS.open("/wizard/dst_time.txt", "r");
-  if (!f) {
-    defaultWizardDstTime = DEFAULT_WIZARD_DST_TIME;
-  } else {
-    defaultWizardDstTime = f.readString();
+  applyTuning();
+  scheduler.trigger(tuningSaveTask);
+  tuningNode.setProperty(property.name).send(String(candidate));
+  return true;
+}
+
+String csvField(const char* csv, uint8_t index) {
+  String value = csv;
+  int16_t start = 0;
+  for (uint8_t i = 0; i < index; i++) {
+    start = value.indexOf(',', start);
+    if (start < 0) return "";
+    start++;
   }
-  Homie.getLogger() << F("loaded defaultWizardDstTime=") << defaultWizardDstTime
+  int16_t end = value.indexOf(',', start);
+  value = value.substring(start, end < 0 ? value.length() : end);
+  value.trim();
+  return value;
+}
+
+void enumerateProbes() {
+  // Searching the bus is slow, so only do it once and read by address after
+  probeCount = 0;
+  uint8_t deviceCount = sensors.getDeviceCount();
+  for (uint8_t i = 0; i < deviceCount && probeCount < MAX_TEMPERATURE_PROBES;
+       i++) {
+    TemperatureProbe& probe = probes[probeCount];
+    if (!sensors.getAddress(probe.address, i)) continue;
+    probe.tempC = DEVICE_DISCONNECTED_C;
+    probe.latestC = DEVICE_DISCONNECTED_C;
+    // Only the inside probe sits next to the board and self-heats
+    probe.offsetC = probeCount == 0 ? TEMPERATURE_OFFSET_C : 0;
+    probe.name =
+        probeCount == 0 ? String("Inside") : "Probe " + String(probeCount);
+    if (probeCount == 0) {
+      strcpy(probe.nodeId, "temperature");
+      probe.node = &temperatureNode;
+    } else {
+      sprintf(probe.nodeId, "temperature-%d", probeCount);
+      probe.node = new HomieNode(probe.nodeId, "temperature");
+    }
+    probe.node->advertise("degrees");
+    probe.node->advertise("min");
+    probe.node->advertise("max");
+    probe.node->advertise("stddev");
+    probe.node->advertise("samples");
+    probe.node->advertise("history");
+    probe.node->advertise("unit");
+    probe.node->advertise("name");
+    if (probeCount == 0) probe.node->advertise("conversion");
+    probeCount++;
+  }
+  Homie.getLogger() << F("Found ") << probeCount << F(" temperature probes")
                     << endl;
-  f.close();
-  drawProgress(90, F("Still loading..."));
-  f = SPIFFS.open("/wizard/password.txt", "r");
-  if (f) {
-    wizard.setDefaultWiFiPassword(f.readString());
+}
+
+void loadProbeSettings() {
+  for (uint8_t i = 0; i < probeCount; i++) {
+    String name = csvField(tempProbeNames.get(), i);
+    if (name.length() > 0) probes[i].name = name;
+    String offset = csvField(tempProbeOffsets.get(), i);
+    if (offset.length() > 0) probes[i].offsetC = offset.toFloat();
   }
-  f.close();
-  drawProgress(90, F("Done."));
 }
 
-void saveWizardValue(String name, String value) {
-  File f = SPIFFS.open("/wizard/" + name, "w+");
-  f.print(value);
-  f.close();
-  Homie.getLogger() << F("Saved ") << name << "=" << value << endl;
+void setProbeResolution(uint8_t resolution) {
+  if (resolution == temperatureResolution) return;
+  // Write the scratchpad directly, DallasTemperature::setResolution() also
+  // copies it to the probe EEPROM which would wear out switching this often
+  const uint8_t configs[] = {0x1F, 0x3F, 0x5F, 0x7F};
+  for (uint8_t i = 0; i < probeCount; i++) {
+    ScratchPad scratchPad;
+    sensors.readScratchPad(probes[i].address, scratchPad);
+    oneWire.reset();
+    oneWire.select(probes[i].address);
+    oneWire.write(0x4E);           // write scratchpad
+    oneWire.write(scratchPad[2]);  // keep high alarm
+    oneWire.write(scratchPad[3]);  // keep low alarm
+    oneWire.write(configs[resolution - 9]);
+  }
+  oneWire.reset();
+  temperatureResolution = resolution;
 }
 
-void setup() {
-  Serial.begin(115200);
+uint32_t millisUntilNextSample(uint32_t now) {
+  uint32_t elapsed = now - temperatureSampledAt;
+  uint32_t until = tuning.sampleInterval * 1000;
+  until = elapsed >= until ? 0 : until - elapsed;
+  if (displaySampleWanted) {
+    elapsed = now - displaySampledAt;
+    uint32_t displayUntil = TEMPERATURE_DISPLAY_UPDATE * 1000;
+    displayUntil = elapsed >= displayUntil ? 0 : displayUntil - elapsed;
+    until = min(until, displayUntil);
+  }
+  return until;
+}
 
-  time_t rtc_time_t = 1543819410;  // fake RTC time for now
-  timezone tz_ = {0, 0};
-  timeval tv_ = {rtc_time_t, 0};
-  settimeofday(&tv_, &tz_);
+void requestDisplaySample() {
+  if (displaySampleWanted) return;
+  displaySampleWanted = true;
+  if (!temperatureConverting) scheduler.trigger(sampleTask);
+}
+
+// Reschedules itself so it only wakes when a sample is due or a conversion
+// is expected to be done
+void temperatureSampleLoop() {
+  uint32_t now = millis();
+  if (!temperatureConverting) {
+    if (temperatureSampledAt == 0 ||
+        now - temperatureSampledAt >= tuning.sampleInterval * 1000) {
+      conversionResolution = TEMPERATURE_TELEMETRY_RESOLUTION;
+    } else if (displaySampleWanted &&
+               now - displaySampledAt >= TEMPERATURE_DISPLAY_UPDATE * 1000) {
+      conversionResolution = TEMPERATURE_DISPLAY_RESOLUTION;
+    } else {
+      scheduler.runIn(sampleTask, millisUntilNextSample(now));
+      return;
+    }
+    setProbeResolution(conversionResolution);
+    // Returns immediately since waiting for conversion is disabled
+    sensors.requestTemperatures();
+    temperatureRequestedAt = now;
+    temperatureConverting = true;
+    scheduler.runIn(
+        sampleTask,
+        sensors.millisToWaitForConversion(conversionResolution) * 3 / 4);
+    return;
+  }
+
+  // Fall back on the datasheet conversion time in case the probe is
+  // parasite powered and cannot signal completion
+  bool complete = sensors.isConversionComplete();
+  if (!complete &&
+      now - temperatureRequestedAt <
+          sensors.millisToWaitForConversion(conversionResolution)) {
+    scheduler.runIn(sampleTask, 5);
+    return;
+  }
+  temperatureConverting = false;
+  if (complete) {
+    conversionMillis[conversionResolution - 9] = now - temperatureRequestedAt;
+  }
+  bool fullResolution =
+      conversionResolution == TEMPERATURE_TELEMETRY_RESOLUTION;
+  if (fullResolution) {
+    temperatureSampledAt = now;
+  } else {
+    displaySampledAt = now;
+    displaySampleWanted = false;
+  }
+  // The low bits are undefined below 12 bits
+  float step = 0.0625 * (1 << (12 - conversionResolution));
+
+  for (uint8_t i = 0; i < probeCount; i++) {
+    float tempC = sensors.getTempC(probes[i].address);
+    if (tempC == DEVICE_DISCONNECTED_C) {
+      // Shown as missing rather than stuck on its last reading
+      if (probes[i].tempC != DEVICE_DISCONNECTED_C) {
+        Homie.getLogger() << F("Temperature probe ") << probes[i].name
+                          << F(" disconnected") << endl;
+      }
+      probes[i].tempC = DEVICE_DISCONNECTED_C;
+      continue;
+    }
+    probes[i].tempC = floorf(tempC / step) * step;
+    if (fullResolution) {
+      probes[i].latestC = tempC + probes[i].offsetC;
+      probes[i].window.add(probes[i].latestC);
+    }
+  }
+
+  if (fullResolution && hasProbeTemperature(0) &&
+      (historySampledAt == 0 || now - historySampledAt >= 60 * 1000)) {
+    historySampledAt = now;
+    temperatureHistory.add(probes[0].tempC + probes[0].offsetC);
+    invalidateScreen(5);
+  }
+}
+
+bool hasProbeTemperature(uint8_t index) {
+  return index < probeCount && probes[index].tempC != DEVICE_DISCONNECTED_C;
+}
+
+float getProbeTemperature(uint8_t index) {
+  return toDisplayUnit(probes[index].tempC + probes[index].offsetC);
+}
+
+String formatConversionLatencies() {
+  String latencies;
+  for (uint8_t i = 0; i < 4; i++) {
+    if (conversionMillis[i] == 0) continue;
+    if (latencies.length() > 0) latencies += ",";
+    latencies += String(9 + i) + ":" + String(conversionMillis[i]);
+  }
+  return latencies;
+}
+
+float toDisplayUnit(float tempC) {
+  return IS_METRIC ? tempC : DallasTemperature::toFahrenheit(tempC);
+}
+
+bool clockSet() {
+  // Past the fake RTC time set in setup()
+  return time(nullptr) > 1546300800;
+}
+
+// The Homie topic is <base><device>/<node>/<property>
+void sendTelemetry(HomieNode& node, const char* property,
+                   const String& value) {
+  node.setProperty(property).send(value);
+  size_t topicLength = strlen(Homie.getConfiguration().mqtt.baseTopic) +
+                       strlen(Homie.getConfiguration().deviceId) +
+                       strlen(node.getId()) + strlen(property) + 2;
+  textEncoding.bytes += mqttPublishBytes(topicLength, value.length());
+}
+
+// QoS 1 PUBLISH packet: fixed header, topic, packet id and payload
+uint32_t mqttPublishBytes(size_t topicLength, size_t payloadLength) {
+  uint32_t remaining = 2 + topicLength + 2 + payloadLength;
+  return 1 + (remaining < 128 ? 1 : 2) + remaining;
+}
+
+void recordEncoding(EncodingStats& stats, uint32_t startedAt,
+                    uint32_t bytes) {
+  stats.records++;
+  stats.bytes += bytes;
+  stats.totalUs += micros() - startedAt;
+}
+
+void publishCbor(const CborWriter& cbor, uint32_t startedAt) {
+  if (cbor.overflowed()) {
+    Homie.getLogger() << F("CBOR record over ") << CBOR_RECORD_SIZE
+                      << F(" bytes") << endl;
+    return;
+  }
+  String topic = String(Homie.getConfiguration().mqtt.baseTopic) +
+                 Homie.getConfiguration().deviceId + "/telemetry/cbor";
+  Homie.getMqttClient().publish(topic.c_str(), 1, false,
+                                (const char*)cbor.data(), cbor.length());
+  recordEncoding(cborEncoding, startedAt,
+                 mqttPublishBytes(topic.length(), cbor.length()));
+}
+
+String formatEncodingStats(const char* name, const EncodingStats& stats) {
+  uint32_t records = max(stats.records, (uint32_t)1);
+  return String(name) + ": n=" + String(stats.records) + " bytes=" +
+         String(stats.bytes / records) + " us=" +
+         String(stats.totalUs / records);
+}
+
+void bufferTemperatureWindow(TemperatureProbe& probe) {
+  RunningStats& window = probe.window;
+  TelemetryRecord record;
+  if (clockSet()) {
+    record.at = time(nullptr);
+    record.flags = 0;
+  } else {
+    record.at = millis() / 1000;
+    record.flags = TELEMETRY_UPTIME;
+  }
+  record.probe = &probe - probes;
+  record.mean = lroundf(window.mean() * 100);
+  record.min = lroundf(window.min() * 100);
+  record.max = lroundf(window.max() * 100);
+  record.stddev = lroundf(window.stddev() * 1000);
+  record.samples = window.count();
+  telemetryBuffer.add(record);
+  probe.reportedC = window.mean();
+  window.reset();
+}
+
+void publishTemperatureWindow(TemperatureProbe& probe) {
+  RunningStats& window = probe.window;
+  if (!Homie.isConnected()) {
+    bufferTemperatureWindow(probe);
+    return;
+  }
+  // Deviations scale but do not shift between units
+  float stddev = IS_METRIC ? window.stddev() : window.stddev() * 1.8;
+  Homie.getLogger() << F("Temperature ") << probe.name << F(": ")
+                    << toDisplayUnit(window.mean()) << F(" over ")
+                    << window.count() << F(" samples") << endl;
+  uint32_t startedAt = micros();
+  sendTelemetry(*probe.node, "degrees", String(toDisplayUnit(window.mean())));
+  sendTelemetry(*probe.node, "min", String(toDisplayUnit(window.min())));
+  sendTelemetry(*probe.node, "max", String(toDisplayUnit(window.max())));
+  sendTelemetry(*probe.node, "stddev", String(stddev, 3));
+  sendTelemetry(*probe.node, "samples", String(window.count()));
+  recordEncoding(textEncoding, startedAt, 0);
+
+  if (cborTelemetry.get()) {
+    startedAt = micros();
+    uint8_t buffer[CBOR_RECORD_SIZE];
+    CborWriter cbor(buffer, sizeof(buffer));
+    cbor.map(9);
+    cbor.text("type");
+    cbor.text("temperature");
+    cbor.text("time");
+    cbor.integer(clockSet() ? time(nullptr) : 0);
+    cbor.text("probe");
+    cbor.text(probe.nodeId);
+    cbor.text("unit");
+    cbor.text(IS_METRIC ? "c" : "f");
+    cbor.text("degrees");
+    cbor.real(toDisplayUnit(window.mean()));
+    cbor.text("min");
+    cbor.real(toDisplayUnit(window.min()));
+    cbor.text("max");
+    cbor.real(toDisplayUnit(window.max()));
+    cbor.text("stddev");
+    cbor.real(stddev);
+    cbor.text("samples");
+    cbor.integer(window.count());
+    publishCbor(cbor, startedAt);
+  }
+  probe.reportedC = window.mean();
+  window.reset();
+}
+
+// A few buffered reports per run so the reconnect does not starve the UI
+void replayTelemetry() {
+  if (telemetryBuffer.empty()) return;
+  TelemetryRecord batch[TELEMETRY_REPLAY_BATCH];
+  uint8_t count = telemetryBuffer.take(batch, TELEMETRY_REPLAY_BATCH);
+  for (uint8_t i = 0; i < count; i++) {
+    const TelemetryRecord& record = batch[i];
+    if (record.probe >= probeCount) continue;
+    uint32_t at = record.at;
+    if (record.flags & TELEMETRY_UPTIME) {
+      at = clockSet() ? time(nullptr) - (millis() / 1000 - record.at) : 0;
+    }
+    float stddev = record.stddev / 1000.0;
+    if (!IS_METRIC) stddev *= 1.8;
+    // time,mean,min,max,stddev,samples with time 0 when unknown
+    String history = String(at) + "," +
+                     String(toDisplayUnit(record.mean / 100.0)) + "," +
+                     String(toDisplayUnit(record.min / 100.0)) + "," +
+                     String(toDisplayUnit(record.max / 100.0)) + "," +
+                     String(stddev, 3) + "," + String(record.samples);
+    probes[record.probe].node->setProperty("history").setRetained(false).send(
+        history);
+  }
+}
+
+void temperatureLoop() {
+  uint32_t now = millis();
+  // Not due until there is something to report
+  bool sampled = false;
+  for (uint8_t i = 0; i < probeCount; i++) {
+    if (probes[i].window.count() > 0) sampled = true;
+  }
+  bool due = sampled && (!temperatureReported ||
+                         now - temperatureReportedAt >=
+                             tuning.reportInterval * 1000);
+  double delta = tempReportDelta.get();
+
+  for (uint8_t i = 0; i < probeCount; i++) {
+    TemperatureProbe& probe = probes[i];
+    if (probe.window.count() == 0) continue;
+    bool changed =
+        delta > 0 && fabs(probe.latestC - probe.reportedC) >= delta;
+    if (due || changed) publishTemperatureWindow(probe);
+  }
+
+  if (due) {
+    if (Homie.isConnected()) {
+      temperatureNode.setProperty("conversion").send(
+          formatConversionLatencies());
+    }
+    temperatureReported = true;
+    temperatureReportedAt = now;
+  }
+}
 
-  // Setup pins
-  pinMode(TEMP_PIN, INPUT);
-  sensors.begin();
+// Legacy wizard files, one per answer, from before WizardConfig
+String readLegacyWizardFile(const char* name, const char* fallback) {
+  File f = storage.open(String("/wizard/") + name, "r");
+  if (!f) return fallback;
+  String value = f.readString();
+  f.close();
+  return value;
+}
 
-  ts.begin();
+void setWizardField(char* field, size_t size, const String& value) {
+  strlcpy(field, value.c_str(), size);
+}
 
-  // Setup tickers
-  updateCurrentTicker.attach(5 * 60, []() {
-    if (WiFi.status() == WL_CONNECTED) doCurrentUpdate = true;
-  });
-  updateForecastTicker.attach(20 * 60, []() {
-    if (WiFi.status() == WL_CONNECTED) doForecastUpdate = true;
-  });
-  updateAstronomyTicker.attach(60 * 60, []() {
-    if (WiFi.status() == WL_CONNECTED) doAstronomyUpdate = true;
-  });
-  sendTemperatureTicker.attach(60, []() { doTemperatureSend = true; });
+void migrateLegacyWizardFiles() {
+  static const char* const LEGACY_FILES[] = {
+      "location_id.txt", "location_name.txt", "utc_offset.txt",
+      "st_time.txt",     "dst_time.txt",      "password.txt"};
+  setWizardField(wizardConfig.locationId, sizeof(wizardConfig.locationId),
+                 readLegacyWizardFile("location_id.txt",
+                                      DEFAULT_WIZARD_LOCATION_ID));
+  setWizardField(wizardConfig.locationName, sizeof(wizardConfig.locationName),
+                 readLegacyWizardFile("location_name.txt",
+                                      DEFAULT_WIZARD_LOCATION_NAME));
+  setWizardField(wizardConfig.utcOffset, sizeof(wizardConfig.utcOffset),
+                 readLegacyWizardFile("utc_offset.txt",
+                                      DEFAULT_WIZARD_UTC_OFFSET));
+  setWizardField(wizardConfig.stTime, sizeof(wizardConfig.stTime),
+                 readLegacyWizardFile("st_time.txt", DEFAULT_WIZARD_ST_TIME));
+  setWizardField(wizardConfig.dstTime, sizeof(wizardConfig.dstTime),
+                 readLegacyWizardFile("dst_time.txt", DEFAULT_WIZARD_DST_TIME));
+  setWizardField(wizardConfig.password, sizeof(wizardConfig.password),
+                 readLegacyWizardFile("password.txt", ""));
+
+  bool legacy = false;
+  for (const char* name : LEGACY_FILES) {
+    legacy |= storage.exists(String("/wizard/") + name);
+  }
+  // Only remove the old files once the record is safely written
+  if (legacy && saveWizardConfig(wizardConfig)) {
+    for (const char* name : LEGACY_FILES) {
+      storage.remove(String("/wizard/") + name);
+    }
+    Homie.getLogger() << F("Migrated wizard files to ") << WIZARD_CONFIG_FILE
+                      << endl;
+  }
+}
 
-  // setup graphics driver
-  gfx.init();
-  gfx.fillBuffer(MINI_BLACK);
-  gfx.commit();
-  carousel.setFrames(frames, frameCount);
-  carousel.disableAllIndicators();
-  carousel.setTargetFPS(3);
-  wizard.setCallback(wizardCallback);
-  SPIFFS.begin();
+void loadWizardDefaults() {
+  // Only the first and last steps are drawn, each commit is a full frame
+  drawProgress(15, F("Initializing System..."));
+  uint32_t startedAt = micros();
+  bool loaded = loadWizardConfig(wizardConfig);
+  if (!loaded) migrateLegacyWizardFiles();
+  Homie.getLogger() << (loaded ? F("Loaded wizard config in ")
+                               : F("Loaded legacy wizard files in "))
+                    << micros() - startedAt << F("us") << endl;
+  Homie.getLogger() << F("Wizard defaults: ") << wizardConfig.locationId
+                    << F(" ") << wizardConfig.locationName << F(" ")
+                    << wizardConfig.utcOffset << F(" ") << wizardConfig.stTime
+                    << F(" ") << wizardConfig.dstTime << endl;
+  if (wizardConfig.password[0] != '\0') {
+    wizard.setDefaultWiFiPassword(wizardConfig.password);
+  }
+  drawProgress(90, F("Done."));
+}
 
+// Only needed in configuration mode
+void registerWizardSteps() {
+  wizard.setCallback(wizardCallback);
   wizard.addStep(
-      [](TFTKeyboard* key) { key->setDefaultValue(defaultWizardLocId); },
+      [](TFTKeyboard* key) {
+        key->setDefaultValue(wizardConfig.locationId);
+      },
       [](TFTKeyboard* key) {
         key->draw(
             F("Location ID?\nVisit https://openweathermap.org\nLethbridge: "
@@ -312,82 +1642,274 @@ void setup() {
             false);
       },
       [](String value) {
-        wizardLocId = value;
-        saveWizardValue(F("location_id.txt"), value);
+        setWizardField(wizardConfig.locationId,
+                       sizeof(wizardConfig.locationId), value);
       });
   wizard.addStep(
-      [](TFTKeyboard* key) { key->setDefaultValue(defaultWizardLocName); },
+      [](TFTKeyboard* key) {
+        key->setDefaultValue(wizardConfig.locationName);
+      },
       [](TFTKeyboard* key) {
         key->draw(F("Location Name?\nExample: Lethbridge"), false);
       },
       [](String value) {
-        wizardLocName = value;
-        saveWizardValue(F("location_name.txt"), value);
+        setWizardField(wizardConfig.locationName,
+                       sizeof(wizardConfig.locationName), value);
       });
   wizard.addStep(
-      [](TFTKeyboard* key) { key->setDefaultValue(defaultWizardUtcOffset); },
+      [](TFTKeyboard* key) { key->setDefaultValue(wizardConfig.utcOffset); },
       [](TFTKeyboard* key) { key->draw(F("UTF Offset?\nExample: 7"), false); },
       [](String value) {
-        wizardUtcOffset = value;
-        saveWizardValue(F("utc_offset.txt"), value);
+        setWizardField(wizardConfig.utcOffset, sizeof(wizardConfig.utcOffset),
+                       value);
       });
   wizard.addStep(
-      [](TFTKeyboard* key) { key->setDefaultValue(defaultwizardStTime); },
+      [](TFTKeyboard* key) { key->setDefaultValue(wizardConfig.stTime); },
       [](TFTKeyboard* key) {
         key->draw(F("Standard Time Abbrev?\n\nExample: MST"), false);
       },
       [](String value) {
-        wizardStTime = value;
-        saveWizardValue(F("st_time.txt"), value);
+        setWizardField(wizardConfig.stTime, sizeof(wizardConfig.stTime), value);
       });
   wizard.addStep(
-      [](TFTKeyboard* key) { key->setDefaultValue(defaultWizardDstTime); },
+      [](TFTKeyboard* key) { key->setDefaultValue(wizardConfig.dstTime); },
       [](TFTKeyboard* key) {
         key->draw(F("Daylight Saving Time Abbrev?\nExample: MDT"), false);
       },
       [](String value) {
-        wizardDstTime = value;
-        saveWizardValue(F("dst_time.txt"), value);
+        setWizardField(wizardConfig.dstTime, sizeof(wizardConfig.dstTime),
+                       value);
       });
+}
 
-  // Setup HTTP clients
-  currentWeatherClient.setLanguage(OPEN_WEATHER_LANGUAGE);
-  forecastClient.setLanguage(OPEN_WEATHER_LANGUAGE);
-  forecastClient.setAllowedHours(allowedHours, sizeof(allowedHours));
+void setup() {
+  Serial.begin(115200);
+  // Heavy phases boost to 160MHz, see CpuBoost.h
+  system_update_cpu_freq(SYS_CPU_80MHZ);
+  bootMark(F("serial"));
+
+  // Get a frame on screen before anything else
+  gfx.init();
+  drawProgress(0, F("Starting..."));
+  bootMark(F("display"));
+
+  time_t rtc_time_t = 1543819410;  // fake RTC time for now
+  timezone tz_ = {0, 0};
+  timeval tv_ = {rtc_time_t, 0};
+  settimeofday(&tv_, &tz_);
+
+  // Setup pins
+  pinMode(TEMP_PIN, INPUT);
+  sensors.begin();
+  sensors.setWaitForConversion(false);
+  enumerateProbes();
+  bootMark(F("sensors"));
+
+  // Sets up the chip select and the pen IRQ before anything touches the bus
+  ts.begin();
+  bootMark(F("touch"));
+
+  // Setup scheduled tasks, budgets are only used for run time statistics
+  currentTask = scheduler.add(
+      "current", UPDATE_INTERVAL * 1000,
+      []() {
+        if (!canFetch() || !fetchesWeather()) return;
+        // Throttle the update and try again in 5 seconds if failed
+        if (!updateCurrentWeather(!initialUpdate)) {
+          scheduler.runIn(currentTask, 5000);
+          return;
+        }
+        finishUpdate(UPDATED_CURRENT);
+      },
+      2, 3000000);
+  forecastTask = scheduler.add(
+      "forecast", FORECAST_UPDATE_INTERVAL * 1000,
+      []() {
+        if (!canFetch() || !fetchesWeather()) return;
+        if (!updateForecasts(!initialUpdate)) {
+          scheduler.runIn(forecastTask, 5000);
+          return;
+        }
+        finishUpdate(UPDATED_FORECASTS);
+      },
+      1, 5000000);
+  astronomyTask = scheduler.add(
+      "astronomy", ASTRONOMY_UPDATE_INTERVAL * 1000,
+      []() {
+        if (!canFetch()) return;
+        updateAstronomy(!initialUpdate);
+        finishUpdate(UPDATED_ASTRONOMY);
+      },
+      0, 50000);
+  sampleTask = scheduler.add("sample", 0, temperatureSampleLoop, 3, 20000, 50);
+  scheduler.trigger(sampleTask);
+  scheduler.add("telemetry", 1000,
+                []() {
+                  temperatureLoop();
+                  if (Homie.isConnected()) replayTelemetry();
+                },
+                0, 50000);
+  scheduler.add("messages", 1000, expireMessages);
+  scheduler.add("health", HEALTH_PUBLISH_INTERVAL * 1000, publishHealth);
+  hubTask = scheduler.add("hub", HUB_HEARTBEAT_INTERVAL * 1000, checkHub);
+  scheduler.add("stats", 15 * 60 * 1000, logSchedulerStats);
+#ifdef PROFILING
+  scheduler.add("profile", PROFILE_PUBLISH_INTERVAL * 1000, publishProfile);
+#endif
+
+  carousel.setFrames(frames, frameCount);
+  carousel.disableAllIndicators();
+  carousel.setTargetFPS(CAROUSEL_FPS);
+  carousel.setTimePerTransition(CAROUSEL_TRANSITION_MS);
+  if (!storageBegin()) {
+    Homie.getLogger() << F("Failed to mount ") << STORAGE_NAME << endl;
+  }
+  telemetryBuffer.begin();
+  bootMark(F("storage"));
 
   // Setup Homie
   Homie_setFirmware("weather-station", VERSION);
   Homie_setBrand("IoT");
+  tempProbeNames.setDefaultValue("");
+  tempProbeOffsets.setDefaultValue("");
+  tempReportInterval.setDefaultValue(300).setValidator(
+      [](long candidate) { return candidate >= TEMPERATURE_UPDATE; });
+  tempReportDelta.setDefaultValue(0).setValidator(
+      [](double candidate) { return candidate >= 0; });
   displayNode.advertise("message").settable(displayMessageHandler);
   displayNode.advertise("acknowledged");
+  displayNode.advertise("message-id");
+  displayNode.advertise("expired");
+  displayNode.advertise("queue-depth");
+  displayNode.advertise("queue-dropped");
+  displayNode.advertise("awake").settable(displayAwakeHandler);
+  cpuBoostPhases.setDefaultValue(0xF).setValidator(
+      [](long candidate) { return candidate >= 0 && candidate <= 0xF; });
+  displayIdleTimeout.setDefaultValue(0).setValidator(
+      [](long candidate) { return candidate >= 0; });
+  displayOffHour.setDefaultValue(-1).setValidator(
+      [](long candidate) { return candidate >= -1 && candidate < 24; });
+  displayOnHour.setDefaultValue(-1).setValidator(
+      [](long candidate) { return candidate >= -1 && candidate < 24; });
+  cborTelemetry.setDefaultValue(false);
+  hubMode.setDefaultValue("off").setValidator([](const char* candidate) {
+    return strcmp(candidate, "off") == 0 || strcmp(candidate, "hub") == 0 ||
+           strcmp(candidate, "follow") == 0;
+  });
+  for (uint8_t i = 0; i < TUNING_PROPERTY_COUNT; i++) {
+    tuningNode.advertise(TUNING_PROPERTIES[i].name)
+        .settable([i](const HomieRange& range, const String& value) {
+          return tuningHandler(i, value);
+        });
+  }
+
+  healthNode.advertise("heap");
+  healthNode.advertise("max-block");
+  healthNode.advertise("fragmentation");
+  healthNode.advertise("stack");
+  healthNode.advertise("loop-rate");
+  healthNode.advertise("rssi");
+  healthNode.advertise("wifi-reconnects");
+  healthNode.advertise("mqtt-reconnects");
+  healthNode.advertise("fetch-current");
+  healthNode.advertise("fetch-forecast");
+  healthNode.advertise("telemetry");
+
+  diagnosticsNode.advertise("boot");
+  diagnosticsNode.advertise("touch");
+  diagnosticsNode.advertise("touch-trace").settable(touchTraceHandler);
+  diagnosticsNode.advertise("touch-replay");
+  diagnosticsNode.advertise("encoding");
+  diagnosticsNode.advertise("snapshot").settable(snapshotHandler);
+  diagnosticsNode.advertise("storage-bench").settable(storageBenchHandler);
+#ifdef PROFILING
+  for (uint8_t i = 0; i < PHASE_COUNT; i++) {
+    diagnosticsNode.advertise(PROFILE_PHASE_NAMES[i]);
+  }
+  diagnosticsNode.advertise("cpu");
+#endif
   Homie.onEvent(onHomieEvent);
   Homie.setSetupFunction(initialize);
-  Homie.setLoopFunction(temperatureLoop);
   Homie.setBroadcastHandler(broadcastHandler);
   Homie.setup();
+  bootMark(F("homie"));
+
+  // Anything not needed for the first frame runs from the first loop()
+  scheduler.trigger(scheduler.add("deferred", 0, deferredSetup, 4));
+  bootTask = scheduler.add("boot", 1000, publishBootTimeline);
+  replayTask = scheduler.add("replay", 0, replayTouchTrace, 2);
+  snapshotTask = scheduler.add("snapshot", 0, snapshotLoop, 1);
+  tuningSaveTask = scheduler.add("tuning", 0, saveTuning);
+  storageBenchTask = scheduler.add("storage-bench", 0, publishStorageBench);
+}
+
+void deferredSetup() {
+  // Setup HTTP clients
+  currentWeatherClient.setLanguage(OPEN_WEATHER_LANGUAGE);
+  forecastClient.setLanguage(OPEN_WEATHER_LANGUAGE);
+  forecastClient.setAllowedHours(allowedHours, sizeof(allowedHours));
 
   boolean isCalibrationAvailable = touchController.loadCalibration();
   if (!isCalibrationAvailable) {
     Homie.getLogger() << F("Calibration not available") << endl;
     touchController.calibrate(calibrationCallback);
   }
+  touchReady = true;
+  bootMark(F("calibration"));
+}
+
+void bootMark(const __FlashStringHelper* stage) {
+  if (bootStageCount == MAX_BOOT_STAGES) return;
+  bootStages[bootStageCount].name = stage;
+  bootStages[bootStageCount].at = micros();
+  bootStageCount++;
+}
+
+String formatBootTimeline() {
+  // Milliseconds since reset at the end of each stage
+  String timeline;
+  for (uint8_t i = 0; i < bootStageCount; i++) {
+    if (i > 0) timeline += ' ';
+    timeline += String(bootStages[i].name) + "=" +
+                String(bootStages[i].at / 1000);
+  }
+  return timeline;
+}
+
+void publishBootTimeline() {
+  if (!Homie.isConnected() || !firstFrameDrawn) return;
+  String timeline = formatBootTimeline();
+  Homie.getLogger() << F("Boot timeline: ") << timeline << endl;
+  diagnosticsNode.setProperty("boot").send(timeline);
+  scheduler.disable(bootTask);
 }
 
 void onHomieEvent(const HomieEvent& event) {
   switch (event.type) {
     case HomieEventType::NORMAL_MODE:
       bootMode = HomieBootMode::NORMAL;
+      boostedPhases = cpuBoostPhases.get();
+      // Lets the SDK light sleep during delay() in idleSleep()
+      WiFi.setSleepMode(WIFI_LIGHT_SLEEP);
+      loadProbeSettings();
+      loadTuning();
+      applyTuning();
+      loadHubSettings();
+      screenTouchCallback.enable();
       break;
     case HomieEventType::CONFIGURATION_MODE:
       bootMode = HomieBootMode::CONFIGURATION;
+      registerWizardSteps();
       loadWizardDefaults();
       wizard.start();
       wizardTouchCallback.enable();
       break;
     case HomieEventType::WIFI_CONNECTED:
-      doCurrentUpdate = true;
-      doForecastUpdate = true;
-      doAstronomyUpdate = true;
+      if (wifiConnectedBefore) wifiReconnects++;
+      wifiConnectedBefore = true;
+      scheduler.trigger(currentTask);
+      scheduler.trigger(forecastTask);
+      scheduler.trigger(astronomyTask);
       // Setup timezone configurations
       // https://www.gnu.org/software/libc/manual/html_node/TZ-Variable.html
       tzInfo = String(tzST.get()) + String(tzUtcOffset.get()) +
@@ -397,16 +1919,27 @@ void onHomieEvent(const HomieEvent& event) {
       tzset();
       configTime(0, 0, NTP_SERVERS);
       break;
+    case HomieEventType::MQTT_READY:
+      if (mqttConnectedBefore) mqttReconnects++;
+      mqttConnectedBefore = true;
+      // A follower with nothing retained to show decides soon after
+      if (hubRole == HUB_FOLLOWER && !hubHeard) {
+        scheduler.runIn(hubTask, HUB_RETAINED_WAIT_MS);
+      }
+      break;
     case HomieEventType::OTA_STARTED:
-      updateCurrentTicker.detach();
-      updateForecastTicker.detach();
-      updateAstronomyTicker.detach();
+      scheduler.suspend();
+      otaStartedAt = micros();
+      if (boostedPhases & (1 << BOOST_OTA)) acquireCpuBoost();
       otaState = 1;
       break;
     case HomieEventType::OTA_SUCCESSFUL:
+      finishOtaTiming();
       otaState = 2;
       break;
     case HomieEventType::OTA_FAILED:
+      finishOtaTiming();
+      scheduler.resume();
       otaState = 3;
       break;
     case HomieEventType::OTA_PROGRESS:
@@ -417,7 +1950,86 @@ void onHomieEvent(const HomieEvent& event) {
   };
 }
 
+// A handful of properties once a minute, fetch timings only after a fetch
+void publishHealth() {
+  uint32_t now = millis();
+  uint32_t elapsed = now - loopCountedAt;
+  uint32_t loopRate = elapsed ? (uint64_t)loopCount * 1000 / elapsed : 0;
+  loopCount = 0;
+  loopCountedAt = now;
+  if (!Homie.isConnected()) return;
+
+  uint32_t heap = ESP.getFreeHeap();
+  uint32_t maxBlock = ESP.getMaxFreeBlockSize();
+  uint8_t fragmentation = ESP.getHeapFragmentation();
+  // Lowest free stack since boot
+  uint32_t stack = ESP.getFreeContStack();
+  int32_t rssi = WiFi.RSSI();
+
+  uint32_t startedAt = micros();
+  sendTelemetry(healthNode, "heap", String(heap));
+  sendTelemetry(healthNode, "max-block", String(maxBlock));
+  sendTelemetry(healthNode, "fragmentation", String(fragmentation));
+  sendTelemetry(healthNode, "stack", String(stack));
+  sendTelemetry(healthNode, "loop-rate", String(loopRate));
+  sendTelemetry(healthNode, "rssi", String(rssi));
+  sendTelemetry(healthNode, "wifi-reconnects", String(wifiReconnects));
+  sendTelemetry(healthNode, "mqtt-reconnects", String(mqttReconnects));
+  recordEncoding(textEncoding, startedAt, 0);
+
+  if (cborTelemetry.get()) {
+    startedAt = micros();
+    uint8_t buffer[CBOR_RECORD_SIZE];
+    CborWriter cbor(buffer, sizeof(buffer));
+    cbor.map(10);
+    cbor.text("type");
+    cbor.text("health");
+    cbor.text("time");
+    cbor.integer(clockSet() ? time(nullptr) : 0);
+    cbor.text("heap");
+    cbor.integer(heap);
+    cbor.text("max-block");
+    cbor.integer(maxBlock);
+    cbor.text("fragmentation");
+    cbor.integer(fragmentation);
+    cbor.text("stack");
+    cbor.integer(stack);
+    cbor.text("loop-rate");
+    cbor.integer(loopRate);
+    cbor.text("rssi");
+    cbor.integer(rssi);
+    cbor.text("wifi-reconnects");
+    cbor.integer(wifiReconnects);
+    cbor.text("mqtt-reconnects");
+    cbor.integer(mqttReconnects);
+    publishCbor(cbor, startedAt);
+  }
+  healthNode.setProperty("telemetry")
+      .send("buffered=" + String(telemetryBuffer.buffered()) + " spilled=" +
+            String(telemetryBuffer.spilled()) + " dropped=" +
+            String(telemetryBuffer.dropped()));
+  if (currentWeatherClient.timing.fetches != publishedCurrentFetches) {
+    publishedCurrentFetches = currentWeatherClient.timing.fetches;
+    healthNode.setProperty("fetch-current")
+        .send(formatFetchTiming(currentWeatherClient.timing));
+  }
+  if (forecastClient.timing.fetches != publishedForecastFetches) {
+    publishedForecastFetches = forecastClient.timing.fetches;
+    healthNode.setProperty("fetch-forecast")
+        .send(formatFetchTiming(forecastClient.timing));
+  }
+}
+
+void finishOtaTiming() {
+  recordPhaseTiming(BOOST_OTA, ESP.getCpuFreqMHz() > 80,
+                    micros() - otaStartedAt);
+  if (boostedPhases & (1 << BOOST_OTA)) releaseCpuBoost();
+  Homie.getLogger() << F("Phase timings: ") << formatPhaseTimings() << endl;
+}
+
 void loop() {
+  PROFILE_SCOPE(PHASE_LOOP);
+  loopCount++;
   // Handle OTA display first to ensure it is displayed before restarts
   switch (otaState) {
     case 1:  // started
@@ -438,84 +2050,60 @@ void loop() {
       break;
   }
 
-  touchController.loop();
-  Homie.loop();
+  {
+    PROFILE_SCOPE(PHASE_TOUCH);
+    sampleTouch();
+  }
+  {
+    PROFILE_SCOPE(PHASE_HOMIE);
+    Homie.loop();
+  }
+  {
+    PROFILE_SCOPE(PHASE_TASKS);
+    scheduler.run();
+  }
 
   // Handle Normal mode screen drawing
   switch (bootMode) {
     case HomieBootMode::NORMAL:
-      // Only update data if WiFi connected and interval passed
-      if (doCurrentUpdate || doForecastUpdate || doAstronomyUpdate) {
-        updateData();
-        return;
-      }
-
       // To avoid showing unix time zero dates/temps wait for initial update to
       // run
       if (initialUpdate) {
-        gfx.fillBuffer(MINI_BLACK);
-        // handle message displays
-        if (!message.equals("")) {
-          gfx.setTextAlignment(TEXT_ALIGN_CENTER);
-          gfx.setColor(MINI_BLUE);
-          gfx.setFont(ArialRoundedMTBold_36);
-          gfx.drawString(SCREEN_WIDTH / 2, 5, messageTitle);
-          gfx.setColor(MINI_WHITE);
-          gfx.setFont(ArialMT_Plain_16);
-          gfx.drawStringMaxWidth(SCREEN_WIDTH / 2, 50, 200, message);
-          gfx.setColor(MINI_WHITE);
-          gfx.drawRect(20, 290, SCREEN_WIDTH - 40, 25);
-          gfx.setColor(MINI_BLUE);
-          gfx.setFont(ArialRoundedMTBold_14);
-          gfx.setTextAlignment(TEXT_ALIGN_CENTER);
-          gfx.drawString(SCREEN_WIDTH / 2, 293, messageDismissButton);
+        applyDisplayRequest();
+        updateDisplaySleep();
+        if (displayAsleep || snapshotActive || millisUntilNextFrame() > 0) {
+          break;
+        }
+        lastFrameAt = millis();
+        lastFrameSecond = time(nullptr);
+        BoostedPhase boost(BOOST_RENDER);
+        bool drawn;
+        {
+          PROFILE_SCOPE(PHASE_DRAW);
+          if (touchTiming.pending) touchTiming.renderAt = micros();
+          drawn = drawScreen();
+        }
+        if (drawn) {
+          PROFILE_SCOPE(PHASE_COMMIT);
           gfx.commit();
-          if (messageReady) {
-            displayedAt = millis();
-            messageReady = false;
-          }
-          if (!messageNeedsAcknowledge) {
-            if (millis() - displayedAt > displayLength * 1000) {
-              message = "";
-            } else {
-              messageDismissButton = formatDismiss(
-                  displayLength - (millis() - displayedAt) / 1000);
-            }
-          }
-          return;
         }
-        switch (currentScreen) {
-          case 1:
-            drawCurrentWeatherDetail();
-            break;
-          case 2:
-            drawForecastTable(0);
-            break;
-          case 3:
-            drawForecastTable(4);
-            break;
-          case 4:
-            drawAbout();
-            break;
-          default:
-            drawTime();
-            drawWifiQuality();
-            carousel.update();
-            drawCurrentWeather();
-            drawAstronomy();
+        if (drawn && touchTiming.pending) recordTouchTiming();
+        if (!firstFrameDrawn) {
+          firstFrameDrawn = true;
+          bootMark(F("first frame"));
         }
-        gfx.commit();
       } else {
         if (WiFi.status() != WL_CONNECTED) {
           drawProgress((millis() / 1000) % 100, F("Connecting to WiFi..."),
                        false);
         }
         drawResetButton();
-        rebootButtonCallback.enable();
+        gfx.commit();
       }
       break;
     case HomieBootMode::CONFIGURATION:
       if (wizard.inProgress()) {
+        BoostedPhase boost(BOOST_WIZARD);
         wizard.draw();
       } else {
         drawProgress((millis() / 1000) % 100, F("Getting Started..."));
@@ -524,7 +2112,159 @@ void loop() {
     default:
       break;
   }
-  yield();
+  idleSleep();
+}
+
+// Milliseconds until the current screen needs to be drawn again
+uint32_t millisUntilNextFrame() {
+  if (!initialUpdate) return 0;
+  if (displayAsleep) return UINT32_MAX;
+  uint8_t screen = currentScreen;
+  uint32_t interval;
+  if (shownMessageId != 0) {
+    // Dismiss countdown
+    interval = 1000;
+  } else {
+    switch (currentScreen) {
+      case 1:
+      case 2:
+      case 3:
+      case 5:
+        // Only redrawn when invalidated
+        interval = 0;
+        break;
+      case 4:
+        interval = 1000;
+        break;
+      default:
+        screen = 0;
+        interval = 1000 / tuning.carouselFps;
+        break;
+    }
+  }
+  uint32_t elapsed = millis() - lastFrameAt;
+  uint32_t minimumGap = 1000 / tuning.frameRateCap;
+  uint32_t capped = elapsed >= minimumGap ? 0 : minimumGap - elapsed;
+  if (screen < 16 && dirtyScreens & (1 << screen)) return capped;
+  if (interval == 0) return UINT32_MAX;
+
+  uint32_t until = elapsed >= interval ? 0 : interval - elapsed;
+  if (screen == 0) {
+    // Keep the clock on time
+    timeval now;
+    gettimeofday(&now, nullptr);
+    if (now.tv_sec != lastFrameSecond) return capped;
+    until = min(until, (uint32_t)(1000 - now.tv_usec / 1000));
+  }
+  return max(until, capped);
+}
+
+// Light sleeps until the next frame or task is due, waking early on touch
+void idleSleep() {
+  uint32_t now = millis();
+  if (idleStatsStartedAt == 0) idleStatsStartedAt = now;
+  if (bootMode != HomieBootMode::NORMAL || otaState != 0) {
+    yield();
+    return;
+  }
+
+  uint32_t sleepMs = min(scheduler.millisUntilNext(), millisUntilNextFrame());
+  sleepMs = min(sleepMs, (uint32_t)IDLE_SLEEP_MAX_MS);
+  if (sleepMs == 0) {
+    yield();
+    return;
+  }
+  while (sleepMs > 0 && !ts.tirqTouched()) {
+    uint32_t slice = min(sleepMs, (uint32_t)IDLE_SLEEP_SLICE_MS);
+    delay(slice);
+    sleepMs -= slice;
+  }
+  idleMillis += millis() - now;
+}
+
+// Share of time spent in idleSleep() since the stats were last reset
+uint8_t idlePercent() {
+  uint32_t elapsed = millis() - idleStatsStartedAt;
+  return elapsed ? (uint64_t)idleMillis * 100 / elapsed : 0;
+}
+
+void resetIdleStats() {
+  idleStatsStartedAt = millis();
+  idleMillis = 0;
+}
+
+// Draws the current screen, returns false if it is unchanged and does not
+// need a commit
+bool drawScreen() {
+  Message* shown = messages.find(shownMessageId);
+  if (shown != nullptr) {
+    // Only drawn while the display is awake
+    if (shown->shownAt == 0) shown->shownAt = millis();
+    drawMessage(*shown);
+    if (currentScreen < 16) dirtyScreens &= ~(1 << currentScreen);
+    return true;
+  }
+  switch (currentScreen) {
+    case 1:
+    case 2:
+    case 3:
+    case 5:
+      // Static screens only change when their data does
+      if (!(dirtyScreens & (1 << currentScreen))) return false;
+      gfx.fillBuffer(MINI_BLACK);
+      if (currentScreen == 1) {
+        drawCurrentWeatherDetail();
+      } else if (currentScreen == 5) {
+        drawTemperatureHistory();
+      } else {
+        drawForecastTable(currentScreen == 2 ? 0 : 4);
+      }
+      dirtyScreens &= ~(1 << currentScreen);
+      return true;
+    case 4:
+      drawAbout();
+      dirtyScreens &= ~(1 << currentScreen);
+      return true;
+    default:
+      dirtyScreens &= ~1;
+      gfx.fillBuffer(MINI_BLACK);
+      drawTime();
+      drawWifiQuality();
+      carousel.update();
+      // Automatic transitions go back to the configured speed
+      if (swipedTransition && carousel.getUiState()->frameState == FIXED) {
+        carousel.setTimePerTransition(CAROUSEL_TRANSITION_MS);
+        swipedTransition = false;
+      }
+      drawCurrentWeather();
+      drawAstronomy();
+      return true;
+  }
+}
+
+void drawMessage(const Message& shown) {
+  uint32_t shownSeconds = (millis() - shown.shownAt) / 1000;
+  gfx.fillBuffer(MINI_BLACK);
+  gfx.setTextAlignment(TEXT_ALIGN_CENTER);
+  gfx.setColor(MINI_BLUE);
+  gfx.setFont(ArialRoundedMTBold_36);
+  gfx.drawString(SCREEN_WIDTH / 2, 5, shown.title);
+  gfx.setColor(MINI_WHITE);
+  gfx.setFont(ArialMT_Plain_16);
+  gfx.drawStringMaxWidth(SCREEN_WIDTH / 2, 50, 200, shown.text);
+  gfx.setColor(MINI_WHITE);
+  gfx.drawRect(20, 290, SCREEN_WIDTH - 40, 25);
+  gfx.setColor(MINI_BLUE);
+  gfx.setFont(ArialRoundedMTBold_14);
+  gfx.setTextAlignment(TEXT_ALIGN_CENTER);
+  if (shown.needsAcknowledge) {
+    gfx.drawString(SCREEN_WIDTH / 2, 293, F("ACKNOWLEDGE"));
+  } else {
+    // Dismissed by expireMessages() once the countdown runs out
+    uint8_t left = shownSeconds < displayLength ? displayLength - shownSeconds
+                                                : 0;
+    gfx.drawString(SCREEN_WIDTH / 2, 293, formatDismiss(left));
+  }
 }
 
 void drawResetButton() {
@@ -534,7 +2274,6 @@ void drawResetButton() {
   gfx.setColor(MINI_YELLOW);
   gfx.setTextAlignment(TEXT_ALIGN_CENTER);
   gfx.drawString(SCREEN_WIDTH / 2, 295, F("RESET"));
-  gfx.commit();
 }
 
 void drawWifiQuality() {
@@ -600,6 +2339,7 @@ void drawProgress(uint8_t percentage, String text, bool commit) {
   gfx.setColor(MINI_YELLOW);
 
   gfx.drawString(120, 146, text);
+  invalidateAllScreens();
   gfx.setColor(MINI_WHITE);
   gfx.drawRect(10, 168, 240 - 20, 15);
   gfx.setColor(MINI_BLUE);
@@ -611,7 +2351,11 @@ void drawProgress(uint8_t percentage, String text, bool commit) {
 void drawCurrentWeather() {
   // Rotate every 10 seconds
   bool displayCurrent = millis() - currTempRotateTime < 10 * 1000;
-  if (millis() - currTempRotateTime > 20 * 1000) currTempRotateTime = millis();
+  if (millis() - currTempRotateTime > 20 * 1000) {
+    currTempRotateTime = millis();
+    // Cycle through the probes on each rotation
+    if (probeCount > 0) displayedProbe = (displayedProbe + 1) % probeCount;
+  }
 
   gfx.setTransparentColor(MINI_BLACK);
   gfx.drawPalettedBitmapFromPgm(
@@ -621,18 +2365,22 @@ void drawCurrentWeather() {
   gfx.setFont(ArialRoundedMTBold_14);
   gfx.setColor(MINI_BLUE);
   gfx.setTextAlignment(TEXT_ALIGN_RIGHT);
-  gfx.drawString(220, 65, displayCurrent ? owLocationName.get() : "Inside");
+  gfx.drawString(220, 65,
+                 displayCurrent ? String(owLocationName.get())
+                                : (probeCount > 0 ? probes[displayedProbe].name
+                                                  : String("Inside")));
 
   gfx.setFont(ArialRoundedMTBold_36);
   gfx.setColor(MINI_WHITE);
   gfx.setTextAlignment(TEXT_ALIGN_RIGHT);
 
   if (!displayCurrent) {
-    sensors.requestTemperatures();
-    float insideTemp = IS_METRIC
-                           ? (sensors.getTempCByIndex(0) + TEMPERATURE_OFFSET_C)
-                           : sensors.getTempFByIndex(0);
-    gfx.drawString(220, 78, String(insideTemp, 1) + (IS_METRIC ? "°C" : "°F"));
+    requestDisplaySample();
+    String insideTemp =
+        hasProbeTemperature(displayedProbe)
+            ? String(getProbeTemperature(displayedProbe), 1)
+            : "--";
+    gfx.drawString(220, 78, insideTemp + (IS_METRIC ? "°C" : "°F"));
   } else {
     gfx.drawString(220, 78,
                    String(currentWeather.temp, 1) + (IS_METRIC ? "°C" : "°F"));
@@ -838,6 +2586,7 @@ void drawAbout() {
   drawLabelValue(2, F("Version:"), VERSION);
   drawLabelValue(4, F("SSID:"), WiFi.SSID());
   drawLabelValue(5, F("IP:"), WiFi.localIP().toString());
+  drawLabelValue(3, F("Idle:"), String(idlePercent()) + "%");
   drawLabelValue(6, F("MQTT:"),
                  String(Homie.getConfiguration().mqtt.server.host),
                  Homie.getMqttClient().connected() ? MINI_WHITE : MINI_YELLOW);
@@ -845,8 +2594,11 @@ void drawAbout() {
   drawLabelValue(9, F("Flash Mem:"),
                  String(ESP.getFlashChipRealSize() / 1024 / 1024) + "MB");
   drawLabelValue(10, F("WiFi Strength:"), String(WiFi.RSSI()) + "dB");
+  drawLabelValue(11, F("DS18B20 (ms):"), formatConversionLatencies());
   drawLabelValue(12, F("Chip ID:"), String(ESP.getChipId()));
-  drawLabelValue(13, F("CPU Freq.: "), String(ESP.getCpuFreqMHz()) + "MHz");
+  drawLabelValue(13, F("CPU Freq.: "),
+                 String(ESP.getCpuFreqMHz()) + "MHz (" +
+                     String(boostPercent()) + "% boost)");
   char time_str[15];
   const uint32_t millis_in_day = 1000 * 60 * 60 * 24;
   const uint32_t millis_in_hour = 1000 * 60 * 60;
@@ -858,9 +2610,90 @@ void drawAbout() {
       millis_in_minute;
   sprintf(time_str, "%2dd%2dh%2dm", days, hours, minutes);
   drawLabelValue(14, F("Uptime: "), time_str);
+#ifdef PROFILING
+  const LatencyHistogram& loopLatency = profileHistograms[PHASE_LOOP];
+  drawLabelValue(15, F("Loop p95/max:"),
+                 String(loopLatency.percentile(95) / 1000) + "/" +
+                     String(loopLatency.max() / 1000) + "ms");
+  drawLabelValue(16, F("Draw/Commit:"),
+                 String(profileHistograms[PHASE_DRAW].average() / 1000) + "/" +
+                     String(profileHistograms[PHASE_COMMIT].average() / 1000) +
+                     "ms");
+#endif
   drawResetButton();
 }
 
+String formatHistoryTemp(int16_t centiC) {
+  return String(toDisplayUnit(centiC / 100.0), 1) + (IS_METRIC ? "°C" : "°F");
+}
+
+void drawTemperatureHistory() {
+  gfx.setFont(ArialRoundedMTBold_14);
+  gfx.setTextAlignment(TEXT_ALIGN_CENTER);
+  gfx.setColor(MINI_WHITE);
+  gfx.drawString(120, 2, probeCount > 0 ? probes[0].name : String("Inside"));
+  drawSparkline(25, 140, F("Last 2 hours"), temperatureHistory.fine);
+  drawSparkline(175, 140, F("Last 48 hours"), temperatureHistory.coarse);
+}
+
+template <uint8_t N>
+void drawSparkline(uint16_t y, uint16_t height, String title,
+                   const HistoryTier<N>& tier) {
+  const uint16_t x = 10;
+  const uint16_t width = SCREEN_WIDTH - 20;
+  uint8_t count = tier.size();
+  int16_t minValue = tier.min();
+  int16_t maxValue = tier.max();
+
+  gfx.setFont(ArialRoundedMTBold_14);
+  gfx.setTextAlignment(TEXT_ALIGN_LEFT);
+  gfx.setColor(MINI_YELLOW);
+  gfx.drawString(x, y, title);
+
+  // Leave room for the title above and the summary below the graph
+  uint16_t top = y + 18;
+  uint16_t bottom = y + height - 18;
+  gfx.setColor(MINI_WHITE);
+  gfx.drawRect(x, top, width, bottom - top);
+
+  if (count == 0) {
+    gfx.setTextAlignment(TEXT_ALIGN_CENTER);
+    gfx.drawString(x + width / 2, (top + bottom) / 2 - 7, F("No data yet"));
+    return;
+  }
+
+  // Keep at least a degree of range so sensor noise is not blown up
+  int16_t range = max(maxValue - minValue, 100);
+  int16_t base = (minValue + maxValue - range) / 2;
+  uint16_t plotHeight = bottom - top - 4;
+  gfx.setColor(MINI_BLUE);
+  int16_t lastX = -1;
+  int16_t lastY = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    // Fill from the right so the newest sample is always at the edge
+    int16_t px = x + 2 + (width - 4) * (N - count + i) / (N - 1);
+    int16_t py =
+        bottom - 2 - (int32_t)(tier.get(i) - base) * plotHeight / range;
+    if (lastX < 0) {
+      gfx.setPixel(px, py);
+    } else {
+      gfx.drawLine(lastX, lastY, px, py);
+    }
+    lastX = px;
+    lastY = py;
+  }
+
+  gfx.setFont(ArialMT_Plain_10);
+  gfx.setColor(MINI_WHITE);
+  gfx.setTextAlignment(TEXT_ALIGN_LEFT);
+  gfx.drawString(x, bottom + 3, "Min " + formatHistoryTemp(minValue));
+  gfx.setTextAlignment(TEXT_ALIGN_CENTER);
+  gfx.drawString(x + width / 2, bottom + 3,
+                 "Avg " + formatHistoryTemp(tier.average()));
+  gfx.setTextAlignment(TEXT_ALIGN_RIGHT);
+  gfx.drawString(x + width, bottom + 3, "Max " + formatHistoryTemp(maxValue));
+}
+
 void drawLabelValue(uint8_t line, String label, String value,
                     uint8_t valueColor) {
   const uint8_t labelX = 15;
@@ -883,53 +2716,415 @@ int8_t getWifiQuality() {
   }
 }
 
-void updateData(bool force) {
-  gfx.fillBuffer(MINI_BLACK);
-  gfx.setFont(ArialRoundedMTBold_14);
+uint32_t hashBytes(uint32_t hash, const void* data, size_t length) {
+  // FNV-1a
+  const uint8_t* bytes = (const uint8_t*)data;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
 
-  if (force || doCurrentUpdate) {
-    drawProgress(50, F("Updating conditions..."));
-    currentWeatherClient.setMetric(IS_METRIC);
-    bool doCurrentUpdate_ = !currentWeatherClient.updateCurrentById(
-        &currentWeather, owApiKey.get(), owLocationId.get());
-    Homie.getLogger() << F("Current Forecast Successful? ")
-                      << (doCurrentUpdate_ ? F("False") : F("True")) << endl;
-    doCurrentUpdate = false;
-    // Throttle the update and try again in 5 seconds if failed
-    if (doCurrentUpdate_) {
-      updateCurrentTicker.once(5, []() { doCurrentUpdate = true; });
-    }
+uint32_t hashString(uint32_t hash, const String& value) {
+  return hashBytes(hash, value.c_str(), value.length());
+}
+
+uint32_t hashFloat(uint32_t hash, float value, uint8_t decimals) {
+  // Hash what is displayed, not the raw float, so noise below the displayed
+  // precision does not count as a change
+  int32_t rounded = lroundf(value * powf(10, decimals));
+  return hashBytes(hash, &rounded, sizeof(rounded));
+}
+
+uint32_t hashCurrentWeather() {
+  uint32_t hash = 2166136261UL;
+  hash = hashString(hash, currentWeather.icon);
+  hash = hashString(hash, currentWeather.description);
+  hash = hashFloat(hash, currentWeather.temp, 1);
+  hash = hashFloat(hash, currentWeather.windSpeed, 1);
+  hash = hashFloat(hash, currentWeather.windDeg, 1);
+  hash = hashBytes(hash, &currentWeather.humidity,
+                   sizeof(currentWeather.humidity));
+  hash = hashBytes(hash, &currentWeather.pressure,
+                   sizeof(currentWeather.pressure));
+  hash = hashBytes(hash, &currentWeather.clouds, sizeof(currentWeather.clouds));
+  hash = hashBytes(hash, &currentWeather.visibility,
+                   sizeof(currentWeather.visibility));
+  hash = hashBytes(hash, &currentWeather.sunrise,
+                   sizeof(currentWeather.sunrise));
+  return hashBytes(hash, &currentWeather.sunset, sizeof(currentWeather.sunset));
+}
+
+uint32_t hashForecasts() {
+  uint32_t hash = 2166136261UL;
+  for (uint8_t i = 0; i < MAX_FORECASTS; i++) {
+    hash = hashBytes(hash, &forecasts[i].observationTime,
+                     sizeof(forecasts[i].observationTime));
+    hash = hashString(hash, forecasts[i].icon);
+    hash = hashString(hash, forecasts[i].main);
+    hash = hashFloat(hash, forecasts[i].temp, 1);
+    hash = hashFloat(hash, forecasts[i].rain, 2);
+    hash = hashFloat(hash, forecasts[i].pressure, 0);
+    hash = hashFloat(hash, forecasts[i].windSpeed, 0);
+    hash = hashFloat(hash, forecasts[i].windDeg, 0);
+    hash = hashBytes(hash, &forecasts[i].humidity,
+                     sizeof(forecasts[i].humidity));
   }
+  return hash;
+}
 
-  if (force || doForecastUpdate) {
-    drawProgress(70, F("Updating forecasts..."));
-    forecastClient.setMetric(IS_METRIC);
-    bool doForecastUpdate_ = !forecastClient.updateForecastsById(
-        forecasts, owApiKey.get(), owLocationId.get(), MAX_FORECASTS);
-    Homie.getLogger() << F("Forcast Update Successful? ")
-                      << (doForecastUpdate_ ? F("False") : F("True")) << endl;
-    doForecastUpdate = false;
-    // Throttle the update and try again in 5 seconds if failed
-    if (doForecastUpdate_) {
-      updateForecastTicker.once(5, []() { doForecastUpdate = true; });
-    }
+bool canFetch() {
+  return bootMode == HomieBootMode::NORMAL && WiFi.status() == WL_CONNECTED;
+}
+
+bool updateCurrentWeather(bool showProgress) {
+  BoostedPhase boost(BOOST_FETCH);
+  if (showProgress) drawProgress(50, F("Updating conditions..."));
+  currentWeatherClient.setMetric(IS_METRIC);
+  currentWeatherClient.beginFetch();
+  bool success = currentWeatherClient.updateCurrentById(
+      &currentWeather, owApiKey.get(), owLocationId.get());
+  currentWeatherClient.endFetch();
+  Homie.getLogger() << F("Current Forecast Successful? ")
+                    << (success ? F("True") : F("False")) << endl;
+  if (!success) return false;
+  currentWeatherUpdated();
+  if (publishesWeather()) publishHubCurrent();
+  return true;
+}
+
+void currentWeatherUpdated() {
+  uint32_t hash = hashCurrentWeather();
+  currentWeatherChanged = hash != currentWeatherHash;
+  currentWeatherHash = hash;
+  if (currentWeatherChanged) {
+    invalidateScreen(0);
+    invalidateScreen(1);
+  } else {
+    Homie.getLogger() << F("Current conditions unchanged") << endl;
   }
+}
+
+bool updateForecasts(bool showProgress) {
+  BoostedPhase boost(BOOST_FETCH);
+  if (showProgress) drawProgress(70, F("Updating forecasts..."));
+  forecastClient.setMetric(IS_METRIC);
+  forecastClient.beginFetch();
+  bool success = forecastClient.updateForecastsById(
+      forecasts, owApiKey.get(), owLocationId.get(), MAX_FORECASTS);
+  forecastClient.endFetch();
+  Homie.getLogger() << F("Forcast Update Successful? ")
+                    << (success ? F("True") : F("False")) << endl;
+  if (!success) return false;
+  forecastsUpdated();
+  if (publishesWeather()) publishHubForecasts();
+  return true;
+}
 
-  if (force || doAstronomyUpdate) {
-    drawProgress(80, F("Updating astronomy..."));
-    moonData = astronomy.calculateMoonData(time(nullptr));
-    float lunarMonth = 29.53;
-    moonAge = moonData.phase <= 4
-                  ? lunarMonth * moonData.illumination / 2
-                  : lunarMonth - moonData.illumination * lunarMonth / 2;
-    moonAgeImage = String((char)(65 + ((uint8_t)((26 * moonAge / 30) % 26))));
-    doAstronomyUpdate = false;
+void forecastsUpdated() {
+  uint32_t hash = hashForecasts();
+  forecastsChanged = hash != forecastsHash;
+  forecastsHash = hash;
+  if (forecastsChanged) {
+    invalidateScreen(0);
+    invalidateScreen(2);
+    invalidateScreen(3);
+  } else {
+    Homie.getLogger() << F("Forecasts unchanged") << endl;
   }
+}
+
+void updateAstronomy(bool showProgress) {
+  if (showProgress) drawProgress(80, F("Updating astronomy..."));
+  moonData = astronomy.calculateMoonData(time(nullptr));
+  float lunarMonth = 29.53;
+  moonAge = moonData.phase <= 4
+                ? lunarMonth * moonData.illumination / 2
+                : lunarMonth - moonData.illumination * lunarMonth / 2;
+  moonAgeImage = String((char)(65 + ((uint8_t)((26 * moonAge / 30) % 26))));
+}
+
+void finishUpdate(uint8_t updated) {
+  const uint8_t allData =
+      UPDATED_CURRENT | UPDATED_FORECASTS | UPDATED_ASTRONOMY;
+  updatedData |= updated;
+  if (initialUpdate || updatedData != allData) return;
   initialUpdate = true;
-  nextPage.enable();
-  prevPage.enable();
-  toggle24H.enable();
-  toggleTempUnits.enable();
+  setCurrentScreen(currentScreen);
+}
+
+void updateData() {
+  if (!canFetch()) return;
+  uint8_t updated = UPDATED_ASTRONOMY;
+  if (fetchesWeather()) {
+    // Failures are retried by the scheduled tasks
+    if (updateCurrentWeather(true)) {
+      updated |= UPDATED_CURRENT;
+    } else {
+      scheduler.runIn(currentTask, 5000);
+    }
+    if (updateForecasts(true)) {
+      updated |= UPDATED_FORECASTS;
+    } else {
+      scheduler.runIn(forecastTask, 5000);
+    }
+  } else {
+    // Converted to the new units from the hub's last payloads
+    if (applyHubCurrent(hubCurrentPayload)) updated |= UPDATED_CURRENT;
+    if (applyHubForecasts(hubForecastPayload)) updated |= UPDATED_FORECASTS;
+  }
+  updateAstronomy(true);
+  finishUpdate(updated);
+}
+
+void loadHubSettings() {
+  if (strcmp(hubMode.get(), "hub") == 0) {
+    hubRole = HUB_PUBLISHER;
+  } else if (strcmp(hubMode.get(), "follow") == 0) {
+    hubRole = HUB_FOLLOWER;
+  }
+  hubHeardAt = millis();
+}
+
+bool fetchesWeather() { return hubRole != HUB_FOLLOWER || hubPromoted; }
+
+bool publishesWeather() { return hubRole == HUB_PUBLISHER || hubPromoted; }
+
+// Sends the heartbeat, and promotes a follower to fetcher once the hub has
+// been silent too long. A follower that has heard nothing at all, not even
+// a retained payload, promotes right away rather than wait on the startup
+// screen.
+void checkHub() {
+  if (publishesWeather()) publishHubHeartbeat();
+  if (hubRole != HUB_FOLLOWER || hubPromoted) return;
+  bool neverHeard = !hubHeard && Homie.isConnected();
+  if (!neverHeard && millis() - hubHeardAt < HUB_SILENCE_TIMEOUT * 1000) {
+    return;
+  }
+  Homie.getLogger() << F("Hub silent, fetching weather here") << endl;
+  hubPromoted = true;
+  scheduler.trigger(currentTask);
+  scheduler.trigger(forecastTask);
+}
+
+String hubTopic(const char* kind) {
+  return String(Homie.getConfiguration().mqtt.baseTopic) +
+         "$broadcast/weather-" + owLocationId.get() + "-" + kind;
+}
+
+// version|publisher|published at|metric|...
+String hubHeader() {
+  return "1|" + String(Homie.getConfiguration().deviceId) + "|" +
+         String((uint32_t)time(nullptr)) + "|" + (IS_METRIC ? "1" : "0") +
+         "|";
+}
+
+void publishHubCurrent() {
+  if (!Homie.isConnected()) return;
+  String payload = hubHeader() + currentWeather.icon + "|" +
+                   currentWeather.description + "|" +
+                   String(currentWeather.temp, 1) + "|" +
+                   String(currentWeather.windSpeed, 1) + "|" +
+                   String(currentWeather.windDeg, 0) + "|" +
+                   String(currentWeather.humidity) + "|" +
+                   String(currentWeather.pressure) + "|" +
+                   String(currentWeather.clouds) + "|" +
+                   String(currentWeather.visibility) + "|" +
+                   String(currentWeather.sunrise) + "|" +
+                   String(currentWeather.sunset);
+  Homie.getMqttClient().publish(hubTopic("current").c_str(), 1, true,
+                                payload.c_str());
+}
+
+// One "time,icon,main,temp,rain,pressure,wind speed,wind degrees,humidity"
+// field per forecast
+void publishHubForecasts() {
+  if (!Homie.isConnected()) return;
+  String payload = hubHeader();
+  for (uint8_t i = 0; i < MAX_FORECASTS; i++) {
+    const OpenWeatherMapForecastData& forecast = forecasts[i];
+    if (i > 0) payload += '|';
+    payload += String(forecast.observationTime) + "," + forecast.icon + "," +
+               forecast.main + "," + String(forecast.temp, 1) + "," +
+               String(forecast.rain, 2) + "," + String(forecast.pressure, 0) +
+               "," + String(forecast.windSpeed, 1) + "," +
+               String(forecast.windDeg, 0) + "," + String(forecast.humidity);
+  }
+  Homie.getMqttClient().publish(hubTopic("forecast").c_str(), 1, true,
+                                payload.c_str());
+}
+
+// version|publisher|role, not retained so only a live station is heard
+void publishHubHeartbeat() {
+  if (!Homie.isConnected()) return;
+  String payload = "1|" + String(Homie.getConfiguration().deviceId) + "|" +
+                   (hubPromoted ? "promoted" : "hub");
+  Homie.getMqttClient().publish(hubTopic("alive").c_str(), 0, false,
+                                payload.c_str());
+}
+
+// Any fetching station keeps followers from promoting. A promoted follower
+// steps back for the hub, and for the lower device id of two promoted ones.
+void hubHeartbeatReceived(const String& payload) {
+  FieldCursor fields = {payload, '|', 0};
+  if (!fields.next().equals("1")) return;
+  String publisher = fields.next();
+  bool promoted = fields.next().equals("promoted");
+  String deviceId = Homie.getConfiguration().deviceId;
+  if (publisher.equals(deviceId)) return;
+  hubHeard = true;
+  hubHeardAt = millis();
+  if (hubPromoted && (!promoted || publisher < deviceId)) {
+    Homie.getLogger() << F("Hub ") << publisher << F(" is back") << endl;
+    hubPromoted = false;
+  }
+}
+
+// Walks the separated fields of a hub payload without copying it
+struct FieldCursor {
+  const String& text;
+  char separator;
+  int position;
+
+  String next() {
+    if (position < 0) return "";
+    int end = text.indexOf(separator, position);
+    String field = text.substring(position, end < 0 ? text.length() : end);
+    position = end < 0 ? -1 : end + 1;
+    return field;
+  }
+};
+
+// Checks the header, sets metric to the units the payload is in. Liveness
+// comes from the heartbeats, see hubHeartbeatReceived()
+bool readHubHeader(FieldCursor& fields, bool& metric) {
+  if (!fields.next().equals("1")) return false;
+  String publisher = fields.next();
+  // Published at, only informational
+  fields.next();
+  metric = fields.next().equals("1");
+  // Our own retained payload coming back
+  if (publisher.equals(Homie.getConfiguration().deviceId)) return false;
+  // Weather to show, even if its hub has since died
+  if (!hubHeard) {
+    hubHeard = true;
+    hubHeardAt = millis();
+  }
+  return true;
+}
+
+float convertTemperature(float value, bool metric) {
+  if (metric == IS_METRIC) return value;
+  return IS_METRIC ? (value - 32) * 5 / 9 : value * 9 / 5 + 32;
+}
+
+// m/s and mph
+float convertSpeed(float value, bool metric) {
+  if (metric == IS_METRIC) return value;
+  return IS_METRIC ? value / 2.23694 : value * 2.23694;
+}
+
+bool applyHubCurrent(const String& payload) {
+  FieldCursor fields = {payload, '|', 0};
+  bool metric;
+  if (payload.length() == 0 || !readHubHeader(fields, metric)) return false;
+  currentWeather.icon = fields.next();
+  currentWeather.description = fields.next();
+  currentWeather.temp = convertTemperature(fields.next().toFloat(), metric);
+  currentWeather.windSpeed = convertSpeed(fields.next().toFloat(), metric);
+  currentWeather.windDeg = fields.next().toFloat();
+  currentWeather.humidity = fields.next().toInt();
+  currentWeather.pressure = fields.next().toInt();
+  currentWeather.clouds = fields.next().toInt();
+  currentWeather.visibility = fields.next().toInt();
+  currentWeather.sunrise = fields.next().toInt();
+  currentWeather.sunset = fields.next().toInt();
+  currentWeatherUpdated();
+  return true;
+}
+
+bool applyHubForecasts(const String& payload) {
+  FieldCursor entries = {payload, '|', 0};
+  bool metric;
+  if (payload.length() == 0 || !readHubHeader(entries, metric)) return false;
+  for (uint8_t i = 0; i < MAX_FORECASTS; i++) {
+    String entry = entries.next();
+    FieldCursor fields = {entry, ',', 0};
+    OpenWeatherMapForecastData& forecast = forecasts[i];
+    forecast.observationTime = fields.next().toInt();
+    forecast.icon = fields.next();
+    forecast.main = fields.next();
+    forecast.temp = convertTemperature(fields.next().toFloat(), metric);
+    forecast.rain = fields.next().toFloat();
+    forecast.pressure = fields.next().toFloat();
+    forecast.windSpeed = convertSpeed(fields.next().toFloat(), metric);
+    forecast.windDeg = fields.next().toFloat();
+    forecast.humidity = fields.next().toInt();
+  }
+  forecastsUpdated();
+  return true;
+}
+
+bool hubBroadcastHandler(const String& level, const String& value) {
+  // A hub keeps its own fetches
+  if (hubRole != HUB_FOLLOWER) return false;
+  String prefix = String("weather-") + owLocationId.get() + "-";
+  if (level.equals(prefix + "current")) {
+    if (!applyHubCurrent(value)) return true;
+    hubCurrentPayload = value;
+    if (!fetchesWeather()) finishUpdate(UPDATED_CURRENT);
+  } else if (level.equals(prefix + "forecast")) {
+    if (!applyHubForecasts(value)) return true;
+    hubForecastPayload = value;
+    if (!fetchesWeather()) finishUpdate(UPDATED_FORECASTS);
+  } else if (level.equals(prefix + "alive")) {
+    hubHeartbeatReceived(value);
+  } else {
+    // Another location's hub
+    return false;
+  }
+  return true;
+}
+
+#ifdef PROFILING
+void publishProfile() {
+  if (!Homie.isConnected()) return;
+  // Latencies are in microseconds and cover the time since the last publish
+  for (uint8_t i = 0; i < PHASE_COUNT; i++) {
+    diagnosticsNode.setProperty(PROFILE_PHASE_NAMES[i])
+        .send(profileHistograms[i].summary());
+    profileHistograms[i].reset();
+  }
+  diagnosticsNode.setProperty("cpu").send(formatPhaseTimings());
+}
+#endif
+
+void logSchedulerStats() {
+  Homie.getLogger() << F("Phase timings: ") << formatPhaseTimings() << endl;
+  Homie.getLogger() << F("Idle ") << idlePercent() << F("%") << endl;
+  String latency = formatTouchLatency();
+  Homie.getLogger() << F("Touch latency us: ") << latency << endl;
+  if (Homie.isConnected()) diagnosticsNode.setProperty("touch").send(latency);
+  resetTouchLatency();
+  String encoding = formatEncodingStats("text", textEncoding) + " " +
+                    formatEncodingStats("cbor", cborEncoding);
+  Homie.getLogger() << F("Telemetry per record: ") << encoding << endl;
+  if (Homie.isConnected()) {
+    diagnosticsNode.setProperty("encoding").send(encoding);
+  }
+  textEncoding = {};
+  cborEncoding = {};
+  resetIdleStats();
+  for (uint8_t i = 0; i < scheduler.count(); i++) {
+    const Task& task = scheduler.get(i);
+    Homie.getLogger() << F("Task ") << task.name << F(": runs=") << task.runs
+                      << F(" avg=")
+                      << (task.runs ? task.totalUs / task.runs : 0)
+                      << F("us max=") << task.maxUs << F("us overruns=")
+                      << task.overruns << F(" missed=")
+                      << task.missedDeadlines << endl;
+  }
 }
 
 const char* getTimezone(tm* timeInfo) {
@@ -960,7 +3155,14 @@ void calibrationCallback(int16_t x, int16_t y) {
 }
 
 void wizardCallback(String ssid, String password) {
-  saveWizardValue(F("password.txt"), password);
+  setWizardField(wizardConfig.password, sizeof(wizardConfig.password),
+                 password);
+  // One write for every answer instead of a file per step
+  uint32_t startedAt = micros();
+  bool saved = saveWizardConfig(wizardConfig);
+  Homie.getLogger() << (saved ? F("Saved ") : F("Failed to save "))
+                    << sizeof(wizardConfig) << F(" byte wizard config in ")
+                    << micros() - startedAt << F("us") << endl;
   StaticJsonBuffer<MAX_JSON_CONFIG_ARDUINOJSON_BUFFER_SIZE> jsonBuffer;
   JsonObject& root = jsonBuffer.createObject();
   root["name"] = NAME;
@@ -978,11 +3180,11 @@ void wizardCallback(String ssid, String password) {
   ota["enabled"] = true;
   JsonObject& settings = root.createNestedObject("settings");
   settings["ow_api_key"] = OW_API_KEY;
-  settings["tz_utc_offset"] = wizardUtcOffset;
-  settings["tz_st"] = wizardStTime;
-  settings["tz_dst"] = wizardDstTime;
-  settings["ow_loc_id"] = wizardLocId;
-  settings["ow_loc_name"] = wizardLocName;
+  settings["tz_utc_offset"] = wizardConfig.utcOffset;
+  settings["tz_st"] = wizardConfig.stTime;
+  settings["tz_dst"] = wizardConfig.dstTime;
+  settings["ow_loc_id"] = wizardConfig.locationId;
+  settings["ow_loc_name"] = wizardConfig.locationName;
   Homie.getConfig().write(root);
   Homie.reboot();
 }
@@ -7,7 +7,6 @@
 #include <ILI9341_SPI.h>
 #include <MiniGrafx.h>
 #include <SPI.h>
-#include <Ticker.h>
 #include <XPT2046_Touchscreen.h>
 #include "TFTController.h"
 #include "TFTWizard.h"
@@ -21,10 +20,21 @@
 
 #include <Homie.h>
 #include "ArialRounded.h"
+#include "Cbor.h"
+#include "CpuBoost.h"
+#include "FetchTiming.h"
+#include "MessageQueue.h"
 #include "MoonPhases.h"
+#include "Profiler.h"
+#include "Scheduler.h"
 #include "Secrets.h"
 #include "Settings.h"
+#include "Storage.h"
+#include "TelemetryBuffer.h"
+#include "TemperatureHistory.h"
+#include "TouchRegions.h"
 #include "WeatherIcons.h"
+#include "WizardConfig.h"
 
 #define SCREEN_WIDTH 240
 #define SCREEN_HEIGHT 320
@@ -55,18 +65,20 @@ TFTWizard wizard(&gfx, ArialMT_Plain_16, ArialMT_Plain_10, ArialMT_Plain_10);
 
 OpenWeatherMapCurrentData currentWeather;
 OpenWeatherMapForecastData forecasts[MAX_FORECASTS];
-OpenWeatherMapCurrent currentWeatherClient;
-OpenWeatherMapForecast forecastClient;
+TimedClient<OpenWeatherMapCurrent> currentWeatherClient;
+TimedClient<OpenWeatherMapForecast> forecastClient;
 Astronomy astronomy;
 Astronomy::MoonData moonData;
 
 OneWire oneWire(TEMP_PIN);
 DallasTemperature sensors(&oneWire);
-Ticker updateCurrentTicker;
-Ticker updateForecastTicker;
-Ticker updateAstronomyTicker;
-Ticker sendTemperatureTicker;
+Scheduler scheduler;
 
+void registerWizardSteps();
+void deferredSetup();
+void bootMark(const __FlashStringHelper* stage);
+String formatBootTimeline();
+void publishBootTimeline();
 void calibrationCallback(int16_t x, int16_t y);
 void wizardCallback(String ssid, String password);
 
@@ -75,12 +87,101 @@ int8_t getWifiQuality();
 String getTime(time_t *timestamp);
 const char *getTimezone(tm *timeInfo);
 void onHomieEvent(const HomieEvent &event);
-void updateData(bool force = false);
-void setCurrentScreenCallbacks(bool enabled);
+void finishOtaTiming();
+void publishHealth();
+bool clockSet();
+void replayTelemetry();
+void sendTelemetry(HomieNode &node, const char *property, const String &value);
+uint32_t mqttPublishBytes(size_t topicLength, size_t payloadLength);
+void publishCbor(const CborWriter &cbor, uint32_t startedAt);
+bool storageBegin();
+#ifdef STORAGE_LITTLEFS
+bool migrateFromSpiffs(fs::FS &legacy);
+#endif
+void publishStorageBench();
+bool storageBenchHandler(const HomieRange &range, const String &value);
+void loadTuning();
+void saveTuning();
+void applyTuning();
+bool tuningHandler(uint8_t index, const String& value);
+bool canFetch();
+bool updateCurrentWeather(bool showProgress);
+bool updateForecasts(bool showProgress);
+void updateAstronomy(bool showProgress);
+void finishUpdate(uint8_t updated);
+void updateData();
+void currentWeatherUpdated();
+void forecastsUpdated();
+void loadHubSettings();
+bool fetchesWeather();
+bool publishesWeather();
+void checkHub();
+String hubTopic(const char* kind);
+String hubHeader();
+void publishHubCurrent();
+void publishHubForecasts();
+void publishHubHeartbeat();
+void hubHeartbeatReceived(const String& payload);
+float convertTemperature(float value, bool metric);
+float convertSpeed(float value, bool metric);
+bool applyHubCurrent(const String& payload);
+bool applyHubForecasts(const String& payload);
+bool hubBroadcastHandler(const String& level, const String& value);
+void logSchedulerStats();
+uint32_t millisUntilNextFrame();
+void idleSleep();
+uint8_t idlePercent();
+void resetIdleStats();
+#ifdef PROFILING
+void publishProfile();
+#endif
+void setProbeResolution(uint8_t resolution);
+uint32_t millisUntilNextSample(uint32_t now);
+void requestDisplaySample();
+void temperatureSampleLoop();
+String formatConversionLatencies();
+void enumerateProbes();
+void loadProbeSettings();
+bool hasProbeTemperature(uint8_t index);
+float getProbeTemperature(uint8_t index);
+float toDisplayUnit(float tempC);
+void setCurrentScreen(uint8_t screen);
+struct TouchSample;
+void sampleTouch();
+void handleTouchSample(int16_t x, int16_t y, uint16_t z, uint32_t at);
+void trackGesture(const TouchSample& sample);
+void endGesture(const TouchSample& sample);
+void onSwipe(int16_t dx, int16_t dy, uint32_t pixelsPerSecond);
+void onLongPress(uint32_t at);
+void markTouchAction(uint32_t touchedAt, uint32_t sampledAt);
+void recordTouchTiming();
+String formatTouchLatency();
+void resetTouchLatency();
+void recordTraceSample(int16_t x, int16_t y, uint16_t z);
+bool parseTouchTrace(const String& value);
+bool touchTraceHandler(const HomieRange& range, const String& value);
+void replayTouchTrace();
+void invalidateScreen(uint8_t screen);
+void invalidateAllScreens();
+String snapshotTopic(const char* suffix);
+bool snapshotHandler(const HomieRange& range, const String& value);
+void fillSnapshotChunk();
+uint8_t snapshotPixelAt(uint32_t pixel);
+void snapshotLoop();
 void messageAcknowledge(int16_t x, int16_t y);
+void publishMessageQueue();
+void showCurrentMessage();
+void expireMessages();
 void broadcastDismiss(int16_t x, int16_t y);
 void rebootButton(int16_t x, int16_t y);
+void applyDisplayRequest();
+void sleepDisplay();
+void wakeDisplay();
+bool inDisplayOffHours();
+void updateDisplaySleep();
 
+bool drawScreen();
+void drawMessage(const Message& shown);
 void drawWifiQuality();
 void drawTime();
 void drawProgress(uint8_t percentage, String text, bool commit = true);
@@ -97,10 +198,16 @@ void drawForecast3(MiniGrafx *display, CarouselState *state, int16_t x,
                    int16_t y);
 void drawLabelValue(uint8_t line, String label, String value, uint8_t valueColor = MINI_WHITE);
 void drawAbout();
+void drawTemperatureHistory();
+template <uint8_t N>
+void drawSparkline(uint16_t y, uint16_t height, String title,
+                   const HistoryTier<N>& tier);
 void drawResetButton();
 
 // Callbacks
 void switchPage(bool forward);
+void nextPageTouch(int16_t x, int16_t y);
+void prevPageTouch(int16_t x, int16_t y);
 
 FrameCallback frames[] = {drawForecast1, drawForecast2, drawForecast3};
 int frameCount = 3;
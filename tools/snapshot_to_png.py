@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""Take a framebuffer snapshot of the weather station and save it as a PNG.
+
+    snapshot_to_png.py --host broker --device weather screen.png
+
+The station publishes "width,height,bpp,palette..." on snapshot/info, then
+run length encoded chunks on snapshot/chunk, each prefixed with a 2 byte
+sequence number, and finally its transfer stats on diagnostics/snapshot.
+Needs paho-mqtt, the PNG is written with the standard library only.
+"""
+
+import argparse
+import struct
+import sys
+import threading
+import zlib
+
+import paho.mqtt.client as mqtt
+
+TIMEOUT_SECONDS = 60
+
+
+def capture(args):
+    base = "%s%s/diagnostics/" % (args.base, args.device)
+    snapshot = {"info": None, "chunks": {}, "result": None}
+    done = threading.Event()
+
+    def on_connect(client, userdata, flags, rc):
+        client.subscribe(base + "snapshot/info", qos=1)
+        client.subscribe(base + "snapshot/chunk")
+        client.subscribe(base + "snapshot")
+        client.publish(base + "snapshot/set", "true")
+
+    def on_message(client, userdata, message):
+        if message.topic.endswith("/snapshot/info"):
+            snapshot["info"] = message.payload.decode()
+        elif message.topic.endswith("/snapshot/chunk"):
+            sequence = struct.unpack(">H", message.payload[:2])[0]
+            snapshot["chunks"][sequence] = message.payload[2:]
+        elif not message.retain:
+            snapshot["result"] = message.payload.decode()
+            done.set()
+
+    client = mqtt.Client()
+    if args.username:
+        client.username_pw_set(args.username, args.password)
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(args.host, args.port)
+    client.loop_start()
+    try:
+        if not done.wait(TIMEOUT_SECONDS):
+            sys.exit("The snapshot did not finish")
+    finally:
+        client.loop_stop()
+        client.disconnect()
+    return snapshot
+
+
+def rgb565_to_rgb(color):
+    red = (color >> 11) & 0x1F
+    green = (color >> 5) & 0x3F
+    blue = color & 0x1F
+    return bytes((red * 255 // 31, green * 255 // 63, blue * 255 // 31))
+
+
+def decode(snapshot):
+    if snapshot["info"] is None:
+        sys.exit("Missed the snapshot info")
+    fields = [int(field) for field in snapshot["info"].split(",")]
+    width, height = fields[0], fields[1]
+    palette = [rgb565_to_rgb(color) for color in fields[3:]]
+
+    chunks = snapshot["chunks"]
+    missing = [i for i in range(max(chunks, default=-1) + 1)
+               if i not in chunks]
+    if missing:
+        sys.exit("Missing chunks %s" % missing)
+    pixels = bytearray()
+    for sequence in sorted(chunks):
+        for byte in chunks[sequence]:
+            pixels.extend(palette[byte >> 6] * ((byte & 0x3F) + 1))
+    if len(pixels) != width * height * 3:
+        sys.exit("Decoded %d pixels, expected %d"
+                 % (len(pixels) // 3, width * height))
+    return width, height, pixels
+
+
+def write_png(path, width, height, pixels):
+    def chunk(kind, data):
+        return (struct.pack(">I", len(data)) + kind + data +
+                struct.pack(">I", zlib.crc32(kind + data) & 0xFFFFFFFF))
+
+    stride = width * 3
+    # Filter type 0 for every row
+    raw = b"".join(b"\x00" + bytes(pixels[y * stride:(y + 1) * stride])
+                   for y in range(height))
+    with open(path, "wb") as png:
+        png.write(b"\x89PNG\r\n\x1a\n")
+        png.write(chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, 8, 2,
+                                             0, 0, 0)))
+        png.write(chunk(b"IDAT", zlib.compress(raw, 9)))
+        png.write(chunk(b"IEND", b""))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", required=True)
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--username")
+    parser.add_argument("--password")
+    parser.add_argument("--base", default="homie/",
+                        help="Homie base topic, with the trailing slash")
+    parser.add_argument("--device", required=True, help="Homie device id")
+    parser.add_argument("png")
+    args = parser.parse_args()
+
+    snapshot = capture(args)
+    width, height, pixels = decode(snapshot)
+    write_png(args.png, width, height, pixels)
+    print(snapshot["result"])
+
+
+if __name__ == "__main__":
+    main()
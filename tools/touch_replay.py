@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""Record touch traces from the weather station and replay them to check
+touch to photon latency.
+
+Record one gesture from the panel into a file:
+
+    touch_replay.py --host broker --device weather record swipe.trace
+
+Replay it and fail if the p95 total latency, from the finger landing to the
+commit, is above the limit:
+
+    touch_replay.py --host broker --device weather replay swipe.trace \\
+        --max-p95-ms 150
+
+Traces are "delay,x,y,z;..." with calibrated screen coordinates, the delay
+in milliseconds since the previous sample and z == 0 lifting the pen. Needs
+paho-mqtt.
+"""
+
+import argparse
+import re
+import sys
+import threading
+
+import paho.mqtt.client as mqtt
+
+TIMEOUT_SECONDS = 60
+TOTAL_PATTERN = re.compile(
+    r"total: n=(\d+) avg=(\d+) p50=(\d+) p95=(\d+) max=(\d+)")
+
+
+def request(args, payload, reply_property):
+    base = "%s%s/diagnostics/" % (args.base, args.device)
+    reply = {}
+    done = threading.Event()
+
+    def on_connect(client, userdata, flags, rc):
+        client.subscribe(base + reply_property)
+        client.publish(base + "touch-trace/set", payload)
+
+    def on_message(client, userdata, message):
+        # Skip the retained value from an earlier run
+        if message.retain:
+            return
+        reply["value"] = message.payload.decode()
+        done.set()
+
+    client = mqtt.Client()
+    if args.username:
+        client.username_pw_set(args.username, args.password)
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(args.host, args.port)
+    client.loop_start()
+    try:
+        if not done.wait(TIMEOUT_SECONDS):
+            sys.exit("No reply on %s%s" % (base, reply_property))
+    finally:
+        client.loop_stop()
+        client.disconnect()
+    return reply["value"]
+
+
+def record(args):
+    print("Touch the screen...")
+    trace = request(args, "record", "touch-trace")
+    with open(args.trace, "w") as trace_file:
+        trace_file.write(trace + "\n")
+    print("Recorded %d samples" % trace.count(";"))
+
+
+def replay(args):
+    with open(args.trace) as trace_file:
+        trace = trace_file.read().strip()
+    result = request(args, trace, "touch-replay")
+    print(result)
+    match = TOTAL_PATTERN.search(result)
+    if match is None or int(match.group(1)) == 0:
+        sys.exit("The replay produced no frames")
+    p95_ms = int(match.group(4)) / 1000.0
+    if args.max_p95_ms and p95_ms > args.max_p95_ms:
+        sys.exit("p95 %.1fms is above %.1fms" % (p95_ms, args.max_p95_ms))
+    print("p95 %.1fms" % p95_ms)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", required=True)
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--username")
+    parser.add_argument("--password")
+    parser.add_argument("--base", default="homie/",
+                        help="Homie base topic, with the trailing slash")
+    parser.add_argument("--device", required=True, help="Homie device id")
+    commands = parser.add_subparsers(dest="command")
+    commands.required = True
+    record_parser = commands.add_parser("record")
+    record_parser.add_argument("trace")
+    record_parser.set_defaults(run=record)
+    replay_parser = commands.add_parser("replay")
+    replay_parser.add_argument("trace")
+    replay_parser.add_argument("--max-p95-ms", type=float)
+    replay_parser.set_defaults(run=replay)
+    args = parser.parse_args()
+    args.run(args)
+
+
+if __name__ == "__main__":
+    main()